@@ -0,0 +1,231 @@
+#include "adaptive_pool.h"
+#include "input_source.h"
+#include "placement.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace {
+
+struct Sample {
+    chrono::steady_clock::time_point when;
+    unsigned long long bytes = 0;   // rchar: everything read(), page cache or not
+    unsigned long long cpu = 0;     // all CPU time, in ticks
+    unsigned long long iowait = 0;
+};
+
+Sample sample()
+{
+    Sample s;
+    s.when = chrono::steady_clock::now();
+    ifstream io("/proc/self/io");
+    string key;
+    while (io >> key) {
+        if (key == "rchar:") {
+            io >> s.bytes;
+            break;
+        }
+        io.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+
+    // First line: cpu user nice system idle iowait irq softirq steal ...
+    // Machine-wide, not for this process.
+    ifstream stat("/proc/stat");
+    string line;
+    getline(stat, line);
+    istringstream fields(line);
+    fields >> key;
+    unsigned long long value;
+    for (int i = 0; fields >> value; i++) {
+        s.cpu += value;
+        if (i == 4) s.iowait = value;
+    }
+    return s;
+}
+
+}
+
+AdaptivePool::AdaptivePool(Shared& data, size_t jobs)
+    : data(data), jobs(jobs), cores(max(1u, thread::hardware_concurrency()))
+{
+    size_t pool_size = min(jobs, max<size_t>(64, 4 * cores));
+    workers = Knob{max<size_t>(1, min(cores, pool_size)), 1, max<size_t>(1, pool_size)};
+    read_ahead = Knob{0, 0, MAX_READ_AHEAD_MB};
+    active = workers.value;
+    summary.max_workers = pool_size;
+
+    queues.push_back(make_unique<Queue>());
+    for (size_t i = 0; i < jobs; i++) queues[0]->jobs.push_back(i);
+}
+
+void AdaptivePool::pin(const vector<int>& job_node)
+{
+    const NumaTopology& topology = NumaTopology::get();
+    pinned = true;
+    queues.clear();
+    for (size_t n = 0; n <= topology.nodes(); n++) {
+        queues.push_back(make_unique<Queue>());
+    }
+    for (size_t i = 0; i < jobs; i++) {
+        int node = i < job_node.size() ? job_node[i] : -1;
+        queues[node >= 0 && static_cast<size_t>(node) < topology.nodes() ? node : topology.nodes()]->jobs.push_back(i);
+    }
+}
+
+// The worker's own queue first, then the shared one, then the other nodes'.
+bool AdaptivePool::take(size_t home, size_t& job)
+{
+    size_t order[] = {home, queues.size() - 1};
+    for (size_t q : order) {
+        size_t i = queues[q]->next.fetch_add(1);
+        if (i < queues[q]->jobs.size()) {
+            job = queues[q]->jobs[i];
+            return true;
+        }
+    }
+    for (auto& q : queues) {
+        size_t i = q->next.fetch_add(1);
+        if (i < q->jobs.size()) {
+            job = q->jobs[i];
+            return true;
+        }
+    }
+    exhausted = true;
+    return false;
+}
+
+void AdaptivePool::run(const function<void(size_t)>& job)
+{
+    running = summary.max_workers;
+    vector<thread> threads;
+    for (size_t id = 0; id < summary.max_workers; id++) {
+        threads.emplace_back(&AdaptivePool::worker, this, id, cref(job));
+    }
+    thread controller(&AdaptivePool::control, this);
+    for (auto& t : threads) t.join();
+    controller.join();
+
+    summary.workers = workers.value;
+    summary.read_ahead_mb = read_ahead.value;
+}
+
+void AdaptivePool::worker(size_t id, const function<void(size_t)>& job)
+{
+    size_t home = 0;
+    if (pinned) {
+        const NumaTopology& topology = NumaTopology::get();
+        int cpu = topology.cpu_for(id);
+        pin_current_thread(cpu);
+        home = topology.node_of(cpu);
+    }
+
+    while (true) {
+        {
+            unique_lock<mutex> lock(mtx);
+            gate.wait(lock, [&] { return id < active || exhausted || data.stop.stop_requested(); });
+        }
+        size_t j;
+        if (data.stop.stop_requested() || !take(home, j)) {
+            break;
+        }
+        job(j);
+    }
+
+    // Whoever waits at the gate has to find out that there is nothing left.
+    lock_guard<mutex> lock(mtx);
+    gate.notify_all();
+    if (--running == 0) {
+        finished.notify_all();
+    }
+}
+
+// Moves one step in the knob's direction. Returns false if there was no
+// room to move, in which case the knob turns around for the next time.
+bool AdaptivePool::move(Knob& knob, double iowait)
+{
+    bool deeper = &knob == &read_ahead;
+    if (knob.direction > 0 && iowait < IO_BOUND && (deeper || knob.value >= cores)) {
+        knob.direction = -1;
+    }
+
+    size_t value = knob.value;
+    if (deeper) {
+        value = knob.direction > 0 ? (value == 0 ? 1 : value * 2) : value / 2;
+    } else {
+        value = knob.direction > 0 ? value + 1 : (value > 0 ? value - 1 : 0);
+    }
+    value = clamp(value, knob.min, knob.max);
+    if (value == knob.value) {
+        knob.direction = -knob.direction;
+        return false;
+    }
+    knob.value = value;
+    return true;
+}
+
+// Called with mtx held.
+void AdaptivePool::apply()
+{
+    active = workers.value;
+    set_read_ahead(read_ahead.value << 20);
+    gate.notify_all();
+}
+
+void AdaptivePool::control()
+{
+    Sample last = sample();
+    double iowait_total = 0;
+    double baseline = 0;        // throughput before the move being judged
+    Knob* moved = nullptr;
+    size_t moved_from = 0;
+    bool turn_workers = true;
+
+    unique_lock<mutex> lock(mtx);
+    while (!finished.wait_for(lock, chrono::milliseconds(EPOCH_MS), [&] { return running == 0; })) {
+        lock.unlock();
+        Sample now = sample();
+        double seconds = chrono::duration<double>(now.when - last.when).count();
+        double rate = (now.bytes - last.bytes) / 1e6 / seconds;
+        double iowait = now.cpu > last.cpu ? double(now.iowait - last.iowait) / (now.cpu - last.cpu) : 0;
+        last = now;
+        lock.lock();
+
+        summary.epochs++;
+        summary.best_mb_per_s = max(summary.best_mb_per_s, rate);
+        iowait_total += iowait;
+
+        if (moved) {
+            if (rate > baseline * (1 + TOLERANCE)) {
+                summary.moves_kept++;
+                baseline = rate;
+            } else {
+                moved->value = moved_from;
+                moved->direction = -moved->direction;
+                summary.moves_undone++;
+                // The baseline has to be measured again with the setting
+                // restored, before the next move can be judged against it.
+                moved = nullptr;
+                apply();
+                continue;
+            }
+            moved = nullptr;
+        } else {
+            baseline = rate;
+        }
+
+        // The two knobs take turns, so each move is judged on its own.
+        Knob& knob = turn_workers ? workers : read_ahead;
+        turn_workers = !turn_workers;
+        moved_from = knob.value;
+        if (move(knob, iowait)) {
+            moved = &knob;
+        }
+        apply();
+    }
+    summary.iowait = summary.epochs ? iowait_total / summary.epochs : 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "thread_safe.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Runs one job per file on a pool whose size follows the machine instead of
+// the file count. It starts with a worker per core. Every EPOCH a controller
+// measures how many bytes the process read (/proc/self/io) and how much of
+// the CPU time went to waiting for I/O (/proc/stat), and hill-climbs two
+// knobs: the number of active workers and the read-ahead depth, which is how
+// many bytes of a plain file are requested from the disk ahead of the
+// reader (see set_read_ahead()). A move that does not raise the throughput
+// by at least TOLERANCE is taken back, the throughput is measured again
+// with the old setting, and that knob tries the other direction next time.
+// While iowait is low the search is CPU bound: workers are not added beyond
+// the core count and read-ahead is not deepened. iowait is the machine's,
+// not this process's (the kernel keeps none per process), so I/O by other
+// programs makes the search look more I/O bound than it is.
+//
+// Workers above the current limit finish the file they are on and wait, so
+// the limit never interrupts a file halfway.
+//
+// With pin() every worker stays on one CPU, the workers spread over the NUMA
+// nodes, and each takes the files whose pages are cached on its own node
+// before it helps out with the rest.
+class AdaptivePool {
+public:
+    struct Stats {
+        size_t workers = 0;         // active workers at the end
+        size_t max_workers = 0;     // threads in the pool
+        size_t read_ahead_mb = 0;   // read-ahead depth at the end
+        double best_mb_per_s = 0;
+        double iowait = 0;          // fraction of CPU time, averaged over the run
+        size_t epochs = 0;
+        size_t moves_kept = 0;
+        size_t moves_undone = 0;
+    };
+
+    AdaptivePool(Shared& data, size_t jobs);
+
+    // Pins the workers. job_node[i] is the node index (see NumaTopology)
+    // job i should run on, -1 if it does not matter. Call before run().
+    void pin(const std::vector<int>& job_node);
+
+    // Calls job(i) once for every i in [0, jobs) and returns when all are
+    // done, or as soon as the running ones are once data.stop is requested.
+    void run(const std::function<void(size_t)>& job);
+
+    Stats stats() const { return summary; }
+
+private:
+    static constexpr unsigned EPOCH_MS = 200;
+    static constexpr double TOLERANCE = 0.03;
+    static constexpr double IO_BOUND = 0.05;
+    static constexpr size_t MAX_READ_AHEAD_MB = 64;
+
+    struct Knob {
+        size_t value;
+        size_t min;
+        size_t max;
+        int direction = 1;
+    };
+
+    // Jobs waiting for a worker. One per node when pinned, plus one for the
+    // jobs that can go anywhere, which is the only one otherwise.
+    struct Queue {
+        std::vector<size_t> jobs;
+        std::atomic<size_t> next{0};
+    };
+
+    Shared& data;
+    const size_t jobs;
+    const size_t cores;
+    std::vector<std::unique_ptr<Queue>> queues;
+    bool pinned = false;
+    std::atomic<bool> exhausted{false};
+    std::atomic<size_t> running{0};
+
+    std::mutex mtx;
+    std::condition_variable gate;     // workers above the limit wait here
+    std::condition_variable finished; // wakes the controller at the end
+    size_t active;
+
+    Knob workers;
+    Knob read_ahead;  // in MB, 0 leaves it to the kernel
+    Stats summary;
+
+    bool take(size_t home, size_t& job);
+    void worker(size_t id, const std::function<void(size_t)>& job);
+    void control();
+    bool move(Knob& knob, double iowait);
+    void apply();
+};
@@ -0,0 +1,189 @@
+#include "arguments.h"
+#include "placement.h"
+#include <stdexcept>
+using namespace std;
+
+bool parse_arguments(const vector<string>& args, Config& config)
+{
+    size_t i = 0;
+    while(i < args.size())
+    {
+        const string& arg = args[i];
+        if(arg == "-h" || arg == "--help")
+        {
+            return false;
+        } 
+        else if (arg == "-i" || arg == "--ignore-case") {
+            config.ignore_case = true;
+            i++;
+        } 
+        else if (arg == "-n" || arg == "--line-number") {
+            config.line_number = true;
+            i++;
+        } 
+        else if (arg == "-v" || arg == "--invert-match") {
+            config.invert_match = true;
+            i++;
+        } 
+        else if (arg == "-p" || arg == "--print-lines") {
+            config.print_lines = true;
+            i++;
+        }
+        else if (arg == "-o" || arg == "--only-matching") {
+            config.only_matching = true;
+            i++;
+        }
+        else if (arg == "-A" || arg == "-B" || arg == "-C") {
+            if(i+1 >= args.size())
+                throw runtime_error("Missing line count after " + arg);
+            size_t n = stoul(args[i+1]);
+            if(arg != "-A") config.before_context = n;
+            if(arg != "-B") config.after_context = n;
+            i += 2;
+        }
+        else if (arg == "-c" || arg == "--count") {
+            config.count_only = true;
+            i++;
+        }
+        else if (arg == "-l" || arg == "--files-with-matches") {
+            config.files_with_matches = true;
+            i++;
+        }
+        else if (arg == "--top") {
+            if(i+1 >= args.size())
+                throw runtime_error("Missing count after " + arg);
+            config.top_n = stoul(args[i+1]);
+            i += 2;
+        }
+        else if (arg == "-I") {
+            config.skip_binary = true;
+            i++;
+        }
+        else if (arg == "-a" || arg == "--text") {
+            config.binary_as_text = true;
+            i++;
+        }
+        else if (arg == "--wordcount") {
+            config.word_count = true;
+            i++;
+        }
+        else if (arg == "-m" || arg == "--max-count") {
+            if(i+1 >= args.size())
+                throw runtime_error("Missing count after " + arg);
+            config.max_count = stoul(args[i+1]);
+            i += 2;
+        }
+        else if (arg == "--first") {
+            config.max_count = 1;
+            i++;
+        }
+        else if (arg == "-f" || arg == "--follow") {
+            config.follow = true;
+            i++;
+        }
+        else if (arg == "--serve") {
+            if(i+1 >= args.size())
+                throw runtime_error("Missing socket path after " + arg);
+            config.serve_socket = args[i+1];
+            i += 2;
+        }
+        else if (arg == "--rules") {
+            if(i+1 >= args.size())
+                throw runtime_error("Missing rules file after " + arg);
+            config.rules_file = args[i+1];
+            i += 2;
+        }
+        else if (arg == "--pin") {
+            config.pin_workers = true;
+            i++;
+        }
+        else if (arg == "--numa-buffers") {
+            if(i+1 >= args.size())
+                throw runtime_error("Missing placement after " + arg);
+            config.numa_buffers = args[i+1];
+            parse_buffer_policy(config.numa_buffers);
+            i += 2;
+        }
+        else if (arg == "--json") {
+            config.json = true;
+            i++;
+        }
+        else if (arg == "--stats") {
+            config.stats = true;
+            i++;
+        }
+        else if (arg == "--in-place") {
+            config.in_place = true;
+            i++;
+        }
+        else if (arg == "--dry-run") {
+            config.dry_run = true;
+            i++;
+        }
+        else if (arg == "-r" || arg == "--replace") {
+            config.replace_mode = true;
+            if(i+1 >= args.size()) 
+                throw runtime_error("Missing replacement text after " + arg);
+            config.replacement = args[i+1];
+            i += 2;
+        } else if(arg[0] == '-' && arg != "-")
+        {
+            throw runtime_error("Unknown flag: " + arg);
+        }
+        else {
+            if(config.pattern.empty())
+            {
+                config.pattern = arg;
+            } else {
+                config.files.push_back(arg);
+            }
+            i++;
+        }
+    }
+
+    // The rules file has the patterns.
+    if (!config.rules_file.empty()) {
+        if (config.replace_mode)
+            throw runtime_error("--rules cannot be combined with -r, the replacements come from the rules file.");
+        if (config.in_place || config.dry_run)
+            throw runtime_error("--in-place and --dry-run do not work with --rules.");
+        config.replace_mode = true;
+    }
+
+    // There is no pattern when counting words or applying rules, the first
+    // positional argument is a file too.
+    if ((config.word_count || !config.rules_file.empty()) && !config.pattern.empty()) {
+        config.files.insert(config.files.begin(), config.pattern);
+        config.pattern.clear();
+    }
+
+    if (config.only_matching && config.invert_match)
+        throw runtime_error("-o cannot be combined with -v, non-matching lines have no matches to show.");
+
+    // Context and -o only make sense for printed lines. --json has a record
+    // for every match, unless only the files are asked for.
+    if (config.only_matching || config.before_context || config.after_context ||
+        (config.json && !config.count_only && !config.files_with_matches)) {
+        config.print_lines = true;
+    }
+
+    // A server gets its patterns and files with each request.
+    if (!config.serve_socket.empty()) return true;
+
+    if (config.pattern.empty() && !config.word_count && config.rules_file.empty()) throw runtime_error("Pattern not specified.");
+    if (config.files.empty()) throw runtime_error("No input files specified.");
+    if (config.dry_run && !config.replace_mode)
+        throw runtime_error("--dry-run only works together with -r.");
+    if (config.in_place && !config.replace_mode)
+        throw runtime_error("--in-place only works together with -r.");
+    if (config.in_place && config.replacement.size() != config.pattern.size())
+        throw runtime_error("--in-place needs a replacement exactly as long as the pattern.");
+    if (config.follow && (config.replace_mode || config.word_count))
+        throw runtime_error("--follow only works when searching.");
+    if (config.follow && (config.invert_match || config.only_matching || config.before_context || config.after_context))
+        throw runtime_error("--follow cannot be combined with -v, -o or context (-A/-B/-C).");
+    if (config.json && (config.replace_mode || config.word_count || config.follow || config.top_n > 0))
+        throw runtime_error("--json only works when searching, and not with --follow or --top.");
+
+    return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "config.h"
+#include <string>
+#include <vector>
+
+// Fills config from the command line arguments (without the program name).
+// --serve reuses it for every request it receives. Returns false when help
+// was asked for, throws std::runtime_error on a malformed command line.
+bool parse_arguments(const std::vector<std::string>& args, Config& config);
@@ -11,4 +11,28 @@ struct Config {
   bool line_number = false;
   bool invert_match = false;
   bool replace_mode = false;
+  std::string rules_file;           // --rules FILE, many pattern<TAB>replacement pairs in one pass (implies replacing)
+  bool in_place = false;            // --in-place, with -r and an equally long replacement: overwrite just the matches
+  bool dry_run = false;             // --dry-run, with -r: print a diff of what would change, write nothing
+  bool print_lines = false;         // -p, print every matching line
+  bool only_matching = false;       // -o, print each match with its byte offset
+  size_t before_context = 0;        // -B N (-C N sets both)
+  size_t after_context = 0;         // -A N
+  bool count_only = false;          // -c
+  bool files_with_matches = false;  // -l
+  size_t top_n = 0;                 // --top N
+  bool word_count = false;          // --wordcount, --top N then picks how many words
+  bool skip_binary = false;         // -I
+  bool binary_as_text = false;      // -a, --text
+  size_t max_count = 0;             // -m N, stop after N matches in total (--first is -m 1)
+  bool follow = false;              // -f, keep searching what gets appended
+  bool pin_workers = false;         // --pin, one CPU per worker, files go to the NUMA node that caches them
+  std::string numa_buffers;         // --numa-buffers local|interleave, empty leaves it to the kernel
+  bool json = false;                // --json, JSON Lines records for every match and file instead of text
+  bool stats = false;               // --stats, report what the adaptive worker pool chose
+  std::string serve_socket;         // --serve PATH, answer requests on a Unix socket
+
+  // In these modes stdout carries only results (lines or the per-file
+  // listing), no progress chatter.
+  bool listing_mode() const { return print_lines || count_only || files_with_matches || top_n > 0 || word_count || dry_run || json; }
 };
@@ -1,5 +1,9 @@
 #include "file_processor.h"
 #include "logger.h"
+#include "input_source.h"
+#include "utf8_fold.h"
+#include "placement.h"
+#include "json_writer.h"
 #include <chrono>
 #include <string>
 #include <iostream>
@@ -9,56 +13,550 @@
 #include <cctype>
 #include <mutex>
 #include <thread> 
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <array>
+#include <utility>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 using namespace std;
 
-static string to_lower(const string& str) {
-    string lower_str = str;
-    transform(lower_str.begin(), lower_str.end(), lower_str.begin(), [](unsigned char c) { return tolower(c); } );
-    return lower_str;
-}
+// Files are read a fixed-size chunk at a time and searched as raw bytes, so
+// memory stays bounded no matter how long a line is (or whether the file has
+// lines at all). When only counting, the last pattern.size() - 1 bytes of a
+// chunk are kept in front of the next one, which is all a match crossing the
+// boundary needs.
+static constexpr size_t CHUNK_SIZE = 1 << 20;
 
-static string replace_all(string source, const string& from, const string& to)
+// Adds this chunk's matches to the global -m budget and returns how many of
+// them fit under the limit. The worker that reaches the limit cancels
+// everybody else, which is noticed at the next chunk boundary.
+static size_t claim_matches(size_t found, const Config& config, Shared& data)
 {
-    string new_string;
-    new_string.reserve(source.length());
-    string::size_type last_pos = 0;
-    string::size_type find_pos;
+    if(config.max_count == 0 || found == 0) {
+        return found;
+    }
+    size_t before = data.limit_count.fetch_add(found);
+    if(before + found >= config.max_count) {
+        data.stop.request_stop();
+    }
+    return before >= config.max_count ? 0 : min(found, config.max_count - before);
+}
+
+// Turns matches into output for -p, -o and -A/-B/-C. Nothing is copied until
+// it is printed: context lines are found again in the read buffer, which keeps
+// up to `before` already searched lines in front of the new bytes for that.
+// Positions are offsets into that buffer, shift() follows it when the bytes
+// that are not needed any more are dropped from its front.
+//
+// With --dry-run the same lines come out as a unified diff instead: context
+// lines as they are, every matching line once as it is and once replaced.
+// A file's hunks are held back until close(), so that files searched in
+// parallel do not interleave inside a diff.
+//
+// With --json every match is a record of its own, with the line it is on,
+// and context lines (and the lines -v selects) are records without a match.
+template <bool LineNumbers>
+class LinePrinter {
+public:
+    string out;
 
-    while((find_pos = source.find(from, last_pos)) != string::npos)
+    LinePrinter(const Config& config, string prefix, const char* text)
+        : config(config), prefix(move(prefix)), text(text), diff(config.dry_run), json(config.json),
+          before(config.only_matching ? 0 : config.before_context),
+          after(config.only_matching ? 0 : config.after_context) {}
+
+    // A match of `length` bytes at pos, within the complete lines of [0, limit).
+    void match(size_t pos, size_t length, size_t limit)
     {
-        new_string.append(source, last_pos, find_pos - last_pos);
-        new_string += to;
-        last_pos = find_pos + from.length();
+        size_t start = line_start(pos);
+        if(json) {
+            select(start, limit);
+            size_t end = line_end(start, limit);
+            JsonWriter(out).begin("match").text("file", prefix).number("line", line_at(start))
+                .number("offset", offset + pos).text("match", string_view(text + pos, length))
+                .text("text", string_view(text + start, end - start)).end();
+            return;
+        }
+        if(config.only_matching) {
+            // Every match gets its own line, with its byte offset in the file.
+            add_prefix(line_at(start), ':');
+            out.append(to_string(offset + pos)).push_back(':');
+            out.append(text + pos, length).push_back('\n');
+            return;
+        }
+        select(start, limit);
+    }
+
+    // Prints the line starting at `start`, with its context. With -v these
+    // are the lines without a match.
+    void select(size_t start, size_t limit)
+    {
+        if(start < printed_upto) {
+            return;  // another match on a line that is already out
+        }
+
+        print_after(start, limit);
+
+        size_t first = start;
+        for(size_t k = 0; k < before && first > printed_upto; k++) {
+            first = line_start(first - 1);
+        }
+        size_t number = line_at(first);
+        if(printed_any && number > last_printed + 1) {
+            if(diff) close_hunk();
+            else if(!json && (before || after)) out.append("--\n");
+        }
+        while(first < start) {
+            size_t end = line_end(first, limit);
+            print_line(first, end, number++, '-');
+            first = end + 1;
+        }
+        size_t end = line_end(start, limit);
+        print_line(start, end, number, ':');
+        printed_upto = end + 1;
+        after_left = after;
+    }
+
+    // After-context of the last match that is already in the buffer.
+    void finish(size_t limit)
+    {
+        print_after(limit, limit);
+    }
+
+    // Where the next round's buffer should start: right after the searched
+    // lines, minus the ones that may still be needed as -B context.
+    size_t resume_point(size_t limit)
+    {
+        size_t resume = limit;
+        for(size_t k = 0; k < before && resume > printed_upto; k++) {
+            resume = line_start(resume - 1);
+        }
+        // Context is not worth holding on to more than a chunk of text.
+        if(limit - resume > CHUNK_SIZE) {
+            resume = limit;
+        }
+        return resume;
+    }
+
+    void shift(size_t resume)
+    {
+        line_at(resume);
+        cursor = 0;
+        printed_upto = printed_upto > resume ? printed_upto - resume : 0;
+        offset += resume;
+    }
+
+    // End of the file. With --dry-run this is when its diff goes out.
+    void close()
+    {
+        if(!diff) {
+            return;
+        }
+        close_hunk();
+        if(!hunks.empty()) {
+            out.append("--- a/").append(prefix).append("\n+++ b/").append(prefix).push_back('\n');
+            out.append(hunks);
+            hunks.clear();
+        }
+    }
+
+private:
+    const Config& config;
+    const string prefix;
+    const char* text;
+    const bool diff;
+    const bool json;
+    const size_t before;
+    const size_t after;
+
+    size_t offset = 0;        // file offset of text[0]
+    size_t cursor = 0;        // text[0, cursor) holds `lines_before` more newlines
+    size_t lines_before = 0;  // newlines in the file before text[cursor]
+    size_t printed_upto = 0;  // lines starting before this have been dealt with
+    size_t after_left = 0;
+    size_t last_printed = 0;
+    bool printed_any = false;
+
+    // --dry-run: the hunk being built, and the finished ones of this file.
+    string hunk;
+    string hunks;
+    size_t hunk_start = 0;
+    size_t old_lines = 0;
+    size_t new_lines = 0;
+    // New lines minus old ones over the finished hunks: where the next hunk
+    // starts in the new file, as in diff -u.
+    long long line_delta = 0;
+
+    size_t line_start(size_t pos) const
+    {
+        const char* nl = static_cast<const char*>(memrchr(text, '\n', pos));
+        return nl ? nl - text + 1 : 0;
+    }
+
+    size_t line_end(size_t pos, size_t limit) const
+    {
+        const char* nl = static_cast<const char*>(memchr(text + pos, '\n', limit - pos));
+        return nl ? nl - text : limit;
+    }
+
+    // 1-based number of the line that contains pos. Matches come in order, so
+    // the cursor only ever moves a little.
+    size_t line_at(size_t pos)
+    {
+        if(pos >= cursor) {
+            lines_before += std::count(text + cursor, text + pos, '\n');
+        } else {
+            lines_before -= std::count(text + pos, text + cursor, '\n');
+        }
+        cursor = pos;
+        return lines_before + 1;
+    }
+
+    void print_after(size_t upto, size_t limit)
+    {
+        while(after_left > 0 && printed_upto < upto) {
+            size_t end = line_end(printed_upto, limit);
+            print_line(printed_upto, end, line_at(printed_upto), '-');
+            printed_upto = end + 1;
+            after_left--;
+        }
+    }
+
+    // grep's convention: ':' after the name and number of a matching line,
+    // '-' for context lines.
+    void add_prefix(size_t number, char separator)
+    {
+        if(!prefix.empty()) out.append(prefix).push_back(separator);
+        if constexpr (LineNumbers) out.append(to_string(number)).push_back(separator);
+    }
+
+    void print_line(size_t start, size_t end, size_t number, char separator)
+    {
+        if(diff) {
+            diff_line(string_view(text + start, end - start), number, separator == ':');
+        } else if(json) {
+            // A matching line goes out with each of its matches, see match().
+            if(separator == '-' || config.invert_match) {
+                JsonWriter(out).begin(separator == '-' ? "context" : "line").text("file", prefix).number("line", number)
+                    .number("offset", offset + start).text("text", string_view(text + start, end - start)).end();
+            }
+        } else {
+            add_prefix(number, separator);
+            out.append(text + start, end - start).push_back('\n');
+        }
+        last_printed = number;
+        printed_any = true;
+    }
+
+    // Replaces exactly what ReplaceTransaction::stage() would: every
+    // non-overlapping occurrence, left to right.
+    void diff_line(string_view line, size_t number, bool changed)
+    {
+        if(old_lines == 0) {
+            hunk_start = number;
+        }
+        old_lines++;
+        new_lines++;
+        if(!changed) {
+            hunk.push_back(' ');
+            hunk.append(line).push_back('\n');
+            return;
+        }
+        hunk.push_back('-');
+        hunk.append(line).push_back('\n');
+        hunk.push_back('+');
+        const string& pattern = config.pattern;
+        size_t last = 0, pos;
+        while((pos = line.find(pattern, last)) != string_view::npos) {
+            hunk.append(line.substr(last, pos - last));
+            // Every line the replacement starts is an added line of its own.
+            for(char c : config.replacement) {
+                hunk.push_back(c);
+                if(c == '\n') {
+                    hunk.push_back('+');
+                    new_lines++;
+                }
+            }
+            last = pos + pattern.size();
+        }
+        hunk.append(line.substr(last)).push_back('\n');
+    }
+
+    void close_hunk()
+    {
+        if(old_lines == 0) {
+            return;
+        }
+        hunks.append("@@ -").append(to_string(hunk_start)).push_back(',');
+        hunks.append(to_string(old_lines)).append(" +").append(to_string(hunk_start + line_delta)).push_back(',');
+        hunks.append(to_string(new_lines)).append(" @@\n").append(hunk);
+        line_delta += static_cast<long long>(new_lines) - static_cast<long long>(old_lines);
+        hunk.clear();
+        old_lines = new_lines = 0;
+    }
+};
+
+// The flag combination a kernel is compiled for. Every `if constexpr` on
+// these disappears from the generated loop, so plain counting (no flags) is
+// nothing but read, find and add.
+template <bool FoldCase, bool Invert, bool PrintLines, bool LineNumbers>
+struct SearchPolicy {
+    static constexpr bool fold_case = FoldCase;
+    static constexpr bool invert = Invert;
+    static constexpr bool print_lines = PrintLines;
+    static constexpr bool line_numbers = LineNumbers;
+    // -v decides per line, so it needs whole lines just like printing does.
+    static constexpr bool whole_lines = PrintLines || Invert;
+};
+
+// Everything about one file that does not depend on the policy.
+struct SearchJob {
+    const Config& config;
+    Shared& data;
+    InputSource& input;
+    const string& pattern;
+    const FoldedPattern* folded;  // -i only
+    string prefix;          // "name" in front of printed lines, empty for one file
+    vector<char>& buffer;
+    size_t first_block;     // bytes already read into buffer
+    bool stop_at_first;     // -l, or a binary file: one match is all we need
+    size_t& count;          // added to round by round, so a read error keeps it
+};
+
+template <class Policy>
+static void search_kernel(SearchJob& job)
+{
+    const Config& config = job.config;
+    const string& pattern = job.pattern;
+    char* buffer = job.buffer.data();
+    const size_t buffer_size = job.buffer.size();
+    const char* hay = buffer;
+    // A case-insensitive match can be longer than the pattern (the Kelvin
+    // sign is 3 bytes, k is 1), the overlap has to cover the longest one.
+    const size_t longest = Policy::fold_case ? job.folded->max_match_bytes() : pattern.size();
+    const size_t keep = longest == 0 ? 0 : longest - 1;
+
+    LinePrinter<Policy::line_numbers> lines(config, job.prefix, buffer);
+    size_t& count = job.count;
+    size_t carry = 0;
+    size_t search_from = 0;
+    size_t filled = job.first_block;
+    bool done = filled == 0;
+
+    while(true) {
+        // With whole lines only complete lines are searched and the
+        // unfinished one waits for the next read. A line that fills the whole
+        // buffer on its own is cut there, so memory stays bounded either way.
+        // Lines before search_from were searched last round and are only
+        // still here as -B context.
+        size_t limit = filled;
+        if constexpr (Policy::whole_lines) {
+            if(!done) {
+                const char* nl = static_cast<const char*>(memrchr(hay + search_from, '\n', filled - search_from));
+                if(nl) limit = nl - hay + 1;
+                else if(filled < buffer_size) limit = search_from;
+            }
+        }
+
+        string_view view(hay, limit);
+        size_t match_length = pattern.size();
+        auto next_match = [&](size_t from) {
+            if constexpr (Policy::fold_case) return job.folded->find(hay, limit, from, match_length);
+            else return view.find(pattern, from);
+        };
+        size_t chunk_count = 0;
+        // With -m a line is printed only once it is within the budget, so
+        // printed matches are claimed one at a time rather than per round.
+        const bool claim_each = Policy::print_lines && config.max_count > 0;
+        bool over_budget = false;
+        auto take = [&]() {
+            if(claim_each && claim_matches(1, config, job.data) == 0) {
+                over_budget = true;
+                return false;
+            }
+            return true;
+        };
+        size_t last_pos = search_from, find_pos;
+        // -v: start of the first line of this round not known to match yet.
+        size_t unmatched_from = search_from;
+
+        while((find_pos = next_match(last_pos)) != string_view::npos) {
+            if constexpr (Policy::invert) {
+                const char* ls = static_cast<const char*>(memrchr(hay + unmatched_from, '\n', find_pos - unmatched_from));
+                size_t line_start = ls ? ls - hay + 1 : unmatched_from;
+                const char* le = static_cast<const char*>(memchr(hay + find_pos, '\n', limit - find_pos));
+                size_t next_line = le ? le - hay + 1 : limit;
+
+                // Every line between the previous matching line and this one is selected.
+                for(size_t s = unmatched_from; s < line_start; ) {
+                    const char* nl = static_cast<const char*>(memchr(hay + s, '\n', line_start - s));
+                    if(!take()) break;
+                    if constexpr (Policy::print_lines) lines.select(s, limit);
+                    chunk_count++;
+                    s = nl - hay + 1;
+                }
+                if(over_budget) break;
+                // The rest of a matching line cannot change anything.
+                unmatched_from = next_line;
+                last_pos = next_line;
+            } else {
+                if(!take()) break;
+                chunk_count++;
+                last_pos = find_pos + match_length;
+                if constexpr (Policy::print_lines) lines.match(find_pos, match_length, limit);
+            }
+            if(job.stop_at_first && chunk_count > 0) {
+                done = true;
+                break;
+            }
+        }
+
+        if constexpr (Policy::invert) {
+            if(!(job.stop_at_first && chunk_count > 0) && !over_budget) {
+                for(size_t s = unmatched_from; s < limit; ) {
+                    const char* nl = static_cast<const char*>(memchr(hay + s, '\n', limit - s));
+                    if(!take()) break;
+                    if constexpr (Policy::print_lines) lines.select(s, limit);
+                    chunk_count++;
+                    s = nl ? nl - hay + 1 : limit;
+                }
+            }
+        }
+
+        // Everything before `resume` was either matched already or cannot
+        // start a match that was missed, so the next round starts from there.
+        size_t resume;
+        if constexpr (Policy::print_lines) {
+            lines.finish(limit);
+            resume = lines.resume_point(limit);
+            lines.shift(resume);
+            search_from = limit - resume;
+        } else if constexpr (Policy::whole_lines) {
+            resume = limit;
+            search_from = 0;
+        } else {
+            resume = max(filled > keep ? filled - keep : 0, min<size_t>(last_pos, filled));
+        }
+
+        // Printed matches were claimed as they went out.
+        count += claim_each ? chunk_count : claim_matches(chunk_count, config, job.data);
+        if(over_budget) {
+            done = true;
+        }
+
+        carry = filled - resume;
+        memmove(buffer, buffer + resume, carry);
+
+        // Flushed every round: on a pipe, matches show up as soon as their
+        // line has been read. Each round goes out as one block, so files
+        // searched in parallel interleave whole blocks, never half lines.
+        if constexpr (Policy::print_lines) {
+            if(!lines.out.empty()) {
+                job.data.emit(lines.out);
+                lines.out.clear();
+            }
+        }
+
+        if(done || job.data.stop.stop_requested()) {
+            if constexpr (Policy::print_lines) {
+                lines.close();
+                if(!lines.out.empty()) job.data.emit(lines.out);
+            }
+            break;
+        }
+        // Whatever one read returns is searched straight away, which on a
+        // pipe is often a single line. That is what keeps stdin interactive.
+        size_t got = job.input.read(buffer + carry, buffer_size - carry);
+        filled = carry + got;
+        done = got == 0;
     }
-    
-    new_string += source.substr(last_pos);
-    return new_string;
 }
 
-void execute_search(const string& filename, const Config& config, Shared& data) {
-    auto start = chrono::high_resolution_clock::now();
-    ifstream file(filename);
+using SearchKernel = void (*)(SearchJob&);
 
-    if(!file.is_open()) {
-        Logger::getInstance().logError("Warning: Could not open file " + filename);
-        return;
+template <size_t... I>
+static constexpr array<SearchKernel, sizeof...(I)> make_kernels(index_sequence<I...>)
+{
+    return {&search_kernel<SearchPolicy<(I & 1) != 0, (I & 2) != 0, (I & 4) != 0, (I & 8) != 0>>...};
+}
+
+// One instantiation per flag combination, picked once per file.
+static constexpr auto KERNELS = make_kernels(make_index_sequence<16>());
+
+static SearchKernel pick_kernel(bool fold_case, bool invert, bool print_lines, bool line_numbers)
+{
+    return KERNELS[fold_case | invert << 1 | print_lines << 2 | (print_lines && line_numbers) << 3];
+}
+
+// The name a file is reported under, in output and in its FileResult.
+static string shown_name_of(const string& filename)
+{
+    return filename == "-" ? "(standard input)" : filename;
+}
+
+optional<FileResult> execute_search(const string& filename, const Config& config, Shared& data) {
+    auto start = chrono::high_resolution_clock::now();
+    unique_ptr<InputSource> input;
+    try {
+        input = open_input(filename);
+    } catch (const exception& e) {
+        Logger::getInstance().logError("Warning: Could not open file " + filename + ": " + e.what());
+        return nullopt;
     }
 
-    string line;
-    size_t line_number = 0;
     bool print_filename = config.files.size() > 1;
     size_t count = 0;
+    const string shown_name = shown_name_of(filename);
 
-    string pattern = config.ignore_case ? to_lower(config.pattern) : config.pattern;
+    const string& pattern = config.pattern;
+    optional<FoldedPattern> folded;
+    if(config.ignore_case) {
+        folded.emplace(pattern);
+    }
 
-    while(getline(file, line)) {
-        line_number++;
-        string modified_line = config.ignore_case ? to_lower(line) : line;
-        string::size_type last_pos = 0, find_pos; 
-        while((find_pos = modified_line.find(pattern, last_pos)) != string::npos) {
-            count++;
-            last_pos = find_pos + pattern.size();
+    // The buffer belongs to the thread, so a long-lived worker (--serve)
+    // allocates it once, not once per file.
+    // Each --serve request brings its own --numa-buffers, so the buffer is
+    // placed again whenever the policy, or the buffer itself, has changed.
+    static thread_local vector<char> buffer(2 * CHUNK_SIZE);
+    static thread_local const char* placed_at = nullptr;
+    static thread_local BufferPolicy placed_as = BufferPolicy::Default;
+    BufferPolicy policy = parse_buffer_policy(config.numa_buffers);
+    if(placed_at != buffer.data() || placed_as != policy) {
+        place_buffer(buffer.data(), buffer.size(), policy);
+        placed_at = buffer.data();
+        placed_as = policy;
+    }
+    bool binary = false;
+    bool failed = false;
+
+    try {
+        size_t got = input->read(buffer.data(), buffer.size());
+
+        // Same heuristic as grep: a NUL byte in the first block means binary.
+        binary = !config.binary_as_text && memchr(buffer.data(), '\0', got) != nullptr;
+
+        if(!(binary && config.skip_binary)) {
+            // A binary file is only ever reported as matching, never printed.
+            bool print_lines = config.print_lines && !binary;
+            // A dry run counts every match of a binary file too, that is
+            // how many -r would replace.
+            SearchJob job{config, data, *input, pattern, folded ? &*folded : nullptr,
+                          print_filename || config.dry_run || config.json ? shown_name : string(), buffer, got,
+                          config.files_with_matches || (binary && !config.dry_run), count};
+            pick_kernel(config.ignore_case, config.invert_match, print_lines, config.line_number)(job);
         }
+    } catch (const exception& e) {
+        // A corrupt or truncated compressed file, keep what was counted so far.
+        Logger::getInstance().logError("Error reading " + filename + ": " + e.what());
+        failed = true;
+        data.failed = true;
     }
 
     auto end = chrono::high_resolution_clock::now();
@@ -67,66 +565,136 @@ void execute_search(const string& filename, const Config& config, Shared& data)
     std::unique_lock<std::shared_mutex> data_lock(data.data_mtx);
     data.total_occ += count;
     data_lock.unlock();
+
+    if(binary && config.skip_binary) {
+        return nullopt;
+    }
+
+    FileResult result{shown_name, count, duration, binary};
+    data.results.append(result);
+
+    if(binary && count > 0 && config.dry_run) {
+        data.emit("Binary files a/" + shown_name + " and b/" + shown_name + " differ\n");
+    }
+    else if(binary && count > 0 && config.print_lines && !config.json) {
+        data.emit("Binary file " + shown_name + " matches\n");
+    }
+
+    if(failed) {
+        return nullopt;
+    }
+
+    if(config.listing_mode()) {
+        return result;
+    }
+
+    if(binary) {
+        if(count > 0) Logger::getInstance().log("Binary file " + shown_name + " matches");
+        return result;
+    }
     
-    Logger::getInstance().log("Found " + to_string(count) + " occurrences in " + filename);
-    Logger::getInstance().log("Processed " + filename + " in " + to_string(duration) + " ms");
+    Logger::getInstance().log("Found " + to_string(count) + " occurrences in " + shown_name);
+    Logger::getInstance().log("Processed " + shown_name + " in " + to_string(duration) + " ms");
+    return result;
 }
 
 
-void execute_replace(const string& filename, const Config& config)
+size_t count_range(const string& filename, const string& pattern, uint64_t begin, uint64_t end)
 {
-    ifstream infile(filename);
-    if(!infile.is_open())
-    {
-        Logger::getInstance().logError("Warning: Could not open file for reading: " + filename);
-        return;
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        throw runtime_error(strerror(errno));
     }
+    static thread_local vector<char> buffer(2 * CHUNK_SIZE);
+    // A match that starts before `end` may finish up to this much after it.
+    const size_t keep = pattern.size() - 1;
+    const size_t step = buffer.size() - keep;
+    size_t count = 0;
 
-    string temp_filename = filename + ".tmp";
-    ofstream outfile(temp_filename);
+    for(uint64_t at = begin; at < end; at += step) {
+        size_t starts = min<uint64_t>(step, end - at);
+        size_t got = 0;
+        while(got < starts + keep) {
+            ssize_t n = pread(fd, buffer.data() + got, starts + keep - got, at + got);
+            if(n < 0 && errno == EINTR) continue;
+            if(n < 0) {
+                int err = errno;
+                close(fd);
+                throw runtime_error(strerror(err));
+            }
+            if(n == 0) break;
+            got += n;
+        }
+        string_view view(buffer.data(), got);
+        size_t pos = 0, found;
+        while((found = view.find(pattern, pos)) != string_view::npos && found < starts) {
+            count++;
+            pos = found + pattern.size();
+        }
+        if(got < starts + keep) break;
+    }
+    close(fd);
+    return count;
+}
 
-    if(!outfile.is_open())
-    {
-        Logger::getInstance().logError("Error: Could not create temporary file for writing.");
-        return;
+
+// Every worker appended its own FileResult, merging them is just ordering.
+// -c and -l list files in the order they were given on the command line,
+// --top ranks them by match count.
+void print_file_stats(const Config& config, Shared& data)
+{
+    auto snapshot = data.results.snapshot();
+    vector<const FileResult*> results;
+    results.reserve(snapshot.size());
+    for(const auto& r : snapshot) {
+        results.push_back(&r);
     }
 
-    string line;
-    bool changed = false;
+    unordered_map<string, size_t> position;
+    for(size_t i = 0; i < config.files.size(); i++) {
+        position.emplace(shown_name_of(config.files[i]), i);
+    }
+    sort(results.begin(), results.end(), [&](const FileResult* a, const FileResult* b) {
+        return position[a->filename] < position[b->filename];
+    });
 
-    while(getline(infile, line))
-    {
-        if(line.find(config.pattern) != string::npos)
-        {
-            string modified = replace_all(line, config.pattern, config.replacement);
-            outfile << modified << endl;
-            changed = true;
-        } else {
-            outfile << line << endl;
+    // The match records went out as they were found, the file records
+    // follow in command line order, then the totals.
+    if(config.json) {
+        string out;
+        size_t matched = 0;
+        for(const auto* r : results) {
+            JsonWriter(out).begin("file").text("file", r->filename).number("count", r->count)
+                .flag("binary", r->binary).number("duration_ms", r->duration_ms).end();
+            if(r->count > 0) matched++;
         }
+        JsonWriter(out).begin("summary").number("files", results.size()).number("files_with_matches", matched)
+            .number("total", data.total_occ).flag("stopped", data.stop.stop_requested()).end();
+        data.emit(out);
+        return;
     }
 
-    infile.close();
-    outfile.close();
+    bool with_name = config.files.size() > 1;
 
-    if(changed)
-    {
-        if(remove(filename.c_str()) != 0)
-        {
-            Logger::getInstance().logError("Error: Could not remove original file.");
-            return;
+    if(config.files_with_matches) {
+        for(const auto* r : results) {
+            if(r->count > 0) data.emit(r->filename + "\n");
         }
-        
-        if(rename(temp_filename.c_str(), filename.c_str()) != 0)
-        {
-            Logger::getInstance().logError("Error: Could not rename temporary file.");
+    }
+    else if(config.count_only) {
+        for(const auto* r : results) {
+            data.emit((with_name ? r->filename + ":" + to_string(r->count) : to_string(r->count)) + "\n");
         }
-        else
-        {
-            Logger::getInstance().log("Replaced matches in: " + filename);
+    }
+
+    if(config.top_n > 0) {
+        size_t n = min(config.top_n, results.size());
+        // stable so that ties keep command line order
+        stable_sort(results.begin(), results.end(), [](const FileResult* a, const FileResult* b) {
+            return a->count > b->count;
+        });
+        for(size_t i = 0; i < n && results[i]->count > 0; i++) {
+            data.emit(to_string(results[i]->count) + " " + results[i]->filename + "\n");
         }
-    } else {
-        remove(temp_filename.c_str());
-        Logger::getInstance().log("No matches found in: " + filename);
     }
 }
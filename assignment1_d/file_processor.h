@@ -2,7 +2,18 @@
 
 #include "thread_safe.h"
 #include "config.h"
+#include <cstdint>
+#include <optional>
 #include <string>
 
-void execute_search(const std::string& filename, const Config& config, Shared& data);
-void execute_replace(const std::string& filename, const Config& config);
\ No newline at end of file
+// Returns what was appended to data.results, or nothing if the file could not
+// be read to the end or was skipped as binary.
+std::optional<FileResult> execute_search(const std::string& filename, const Config& config, Shared& data);
+// Counts the occurrences that start in [begin, end) of a plain file, for a
+// piece of a file that WorkPlan split. Every occurrence counts, so this is
+// only the same as execute_search for a pattern that cannot overlap itself.
+// Throws runtime_error if the file cannot be read.
+size_t count_range(const std::string& filename, const std::string& pattern, uint64_t begin, uint64_t end);
+// Prints the -c, -l and --top listings, or the --json file and summary
+// records, once every file has been searched.
+void print_file_stats(const Config& config, Shared& data);
@@ -0,0 +1,310 @@
+#include "follow.h"
+#include "logger.h"
+#include "utf8_fold.h"
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+static constexpr size_t CHUNK_SIZE = 1 << 20;
+static constexpr uint32_t FILE_EVENTS = IN_MODIFY | IN_MOVE_SELF | IN_DELETE_SELF;
+static constexpr uint32_t DIR_EVENTS = IN_CREATE | IN_MOVED_TO;
+
+struct FollowedFile {
+    string path;
+    string dir;
+    string name;
+    int fd = -1;
+    int wd = -1;
+    dev_t dev = 0;
+    ino_t ino = 0;
+    off_t offset = 0;
+    // Already read, but a later write may still complete a match (the last
+    // pattern.size() - 1 bytes) or a line (-p) that starts here.
+    string carry;
+    size_t line_number = 0;
+    size_t count = 0;
+};
+
+class Follower {
+public:
+    Follower(const Config& config, Shared& data)
+        : config(config), data(data),
+          pattern(config.pattern), folded(config.pattern) {}
+
+    ~Follower()
+    {
+        for (auto& f : files) {
+            if (f.fd >= 0) close(f.fd);
+        }
+        if (inotify_fd >= 0) close(inotify_fd);
+    }
+
+    int run();
+
+private:
+    const Config& config;
+    Shared& data;
+    const string pattern;
+    const FoldedPattern folded;  // used with -i
+    int inotify_fd = -1;
+    vector<FollowedFile> files;
+    unordered_map<int, size_t> file_watches;
+    unordered_map<int, vector<size_t>> dir_watches;
+    vector<char> buffer = vector<char>(CHUNK_SIZE);
+
+    bool open_file(FollowedFile& f);
+    void close_file(FollowedFile& f);
+    void drain(FollowedFile& f);
+    void search(FollowedFile& f, const char* bytes, size_t size, bool at_end);
+    void check_truncation(FollowedFile& f);
+    void reopen(FollowedFile& f);
+};
+
+bool Follower::open_file(FollowedFile& f)
+{
+    f.fd = open(f.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (f.fd < 0) {
+        return false;
+    }
+    struct stat st;
+    fstat(f.fd, &st);
+    f.dev = st.st_dev;
+    f.ino = st.st_ino;
+    f.offset = 0;
+    f.carry.clear();
+    f.line_number = 0;
+
+    f.wd = inotify_add_watch(inotify_fd, f.path.c_str(), FILE_EVENTS);
+    if (f.wd >= 0) {
+        file_watches[f.wd] = &f - files.data();
+    }
+    return true;
+}
+
+void Follower::close_file(FollowedFile& f)
+{
+    if (f.fd < 0) return;
+    // Whatever is left is a last line without a newline, it will not grow any more.
+    search(f, nullptr, 0, true);
+    if (f.wd >= 0) {
+        inotify_rm_watch(inotify_fd, f.wd);
+        file_watches.erase(f.wd);
+        f.wd = -1;
+    }
+    close(f.fd);
+    f.fd = -1;
+}
+
+// Reads from the remembered offset to the current end of the file.
+void Follower::drain(FollowedFile& f)
+{
+    while (f.fd >= 0) {
+        ssize_t got = pread(f.fd, buffer.data(), buffer.size(), f.offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) break;
+        f.offset += got;
+        search(f, buffer.data(), got, false);
+    }
+}
+
+void Follower::search(FollowedFile& f, const char* bytes, size_t size, bool at_end)
+{
+    string text = move(f.carry);
+    text.append(bytes, size);
+    if (text.empty() || pattern.empty()) {
+        return;
+    }
+    const string& hay = text;
+
+    // As in execute_search: with -p only complete lines are searched.
+    size_t limit = text.size();
+    if (config.print_lines && !at_end) {
+        size_t nl = hay.rfind('\n');
+        if (nl != string::npos) limit = nl + 1;
+        else if (text.size() < CHUNK_SIZE) limit = 0;
+    }
+
+    string_view view(hay.data(), limit);
+    string out;
+    size_t found = 0;
+    size_t counted_upto = 0;
+    size_t printed_upto = 0;
+    size_t last_pos = 0, find_pos;
+    size_t length = pattern.size();
+    auto next_match = [&](size_t from) {
+        return config.ignore_case ? folded.find(view.data(), view.size(), from, length) : view.find(pattern, from);
+    };
+    while ((find_pos = next_match(last_pos)) != string_view::npos) {
+        found++;
+        last_pos = find_pos + length;
+        if (config.print_lines && find_pos >= printed_upto) {
+            size_t ls = view.rfind('\n', find_pos);
+            size_t line_start = ls == string_view::npos ? 0 : ls + 1;
+            size_t le = view.find('\n', find_pos);
+            size_t line_end = le == string_view::npos ? limit : le;
+
+            f.line_number += std::count(hay.begin() + counted_upto, hay.begin() + line_start, '\n');
+            counted_upto = line_start;
+
+            if (config.files.size() > 1) out.append(f.path).push_back(':');
+            if (config.line_number) out.append(to_string(f.line_number + 1)).push_back(':');
+            out.append(text, line_start, line_end - line_start).push_back('\n');
+            printed_upto = line_end + 1;
+        }
+    }
+
+    size_t resume;
+    if (config.print_lines) {
+        resume = limit;
+        f.line_number += std::count(hay.begin() + counted_upto, hay.begin() + resume, '\n');
+    } else {
+        size_t longest = config.ignore_case ? folded.max_match_bytes() : pattern.size();
+        size_t keep = at_end ? 0 : longest - 1;
+        resume = max(text.size() > keep ? text.size() - keep : 0, min(last_pos, text.size()));
+    }
+    f.carry = text.substr(resume);
+
+    if (!out.empty()) {
+        data.emit(out);
+    }
+    if (found == 0) {
+        return;
+    }
+
+    f.count += found;
+    size_t total;
+    {
+        unique_lock<shared_mutex> lock(data.data_mtx);
+        data.total_occ += found;
+        total = data.total_occ;
+    }
+    if (!config.listing_mode()) {
+        Logger::getInstance().log("Found " + to_string(found) + " new occurrences in " + f.path +
+                                  " (" + to_string(f.count) + " in this file)");
+    }
+    if (config.max_count > 0 && total >= config.max_count) {
+        data.stop.request_stop();
+    }
+}
+
+void Follower::check_truncation(FollowedFile& f)
+{
+    struct stat st;
+    if (f.fd < 0 || fstat(f.fd, &st) != 0 || st.st_size >= f.offset) {
+        return;
+    }
+    if (!config.listing_mode()) {
+        Logger::getInstance().log(f.path + " was truncated, reading it again from the start");
+    }
+    f.offset = 0;
+    f.carry.clear();
+    f.line_number = 0;
+}
+
+// The file under this name has been replaced or has gone away. Finishes the
+// old one and starts on the new one if there is one already.
+void Follower::reopen(FollowedFile& f)
+{
+    drain(f);
+    close_file(f);
+    if (open_file(f)) {
+        if (!config.listing_mode()) {
+            Logger::getInstance().log("Following new " + f.path);
+        }
+        drain(f);
+    }
+}
+
+int Follower::run()
+{
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        Logger::getInstance().logError("inotify is not available: " + string(strerror(errno)));
+        return 1;
+    }
+
+    files.resize(config.files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        FollowedFile& f = files[i];
+        f.path = config.files[i];
+        size_t slash = f.path.rfind('/');
+        f.dir = slash == string::npos ? "." : f.path.substr(0, slash + 1);
+        f.name = slash == string::npos ? f.path : f.path.substr(slash + 1);
+
+        // The directory is watched too, that is where a rotated log reappears.
+        int dir_wd = inotify_add_watch(inotify_fd, f.dir.c_str(), DIR_EVENTS);
+        if (dir_wd >= 0) {
+            dir_watches[dir_wd].push_back(i);
+        }
+        if (!open_file(f)) {
+            Logger::getInstance().logError("Warning: Could not open file " + f.path + ", waiting for it to appear");
+            continue;
+        }
+        drain(f);
+    }
+
+    alignas(inotify_event) char events[64 * 1024];
+    while (!data.stop.stop_requested()) {
+        ssize_t n = read(inotify_fd, events, sizeof(events));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            Logger::getInstance().logError("Reading inotify events failed: " + string(strerror(errno)));
+            return 1;
+        }
+
+        for (char* p = events; p < events + n; ) {
+            auto* ev = reinterpret_cast<inotify_event*>(p);
+            p += sizeof(inotify_event) + ev->len;
+
+            // Events were lost, so every file may have changed.
+            if (ev->mask & IN_Q_OVERFLOW) {
+                for (auto& f : files) {
+                    check_truncation(f);
+                    drain(f);
+                }
+                continue;
+            }
+
+            if (auto it = file_watches.find(ev->wd); it != file_watches.end()) {
+                FollowedFile& f = files[it->second];
+                if (ev->mask & IN_MODIFY) {
+                    check_truncation(f);
+                    drain(f);
+                }
+                if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF)) {
+                    reopen(f);
+                }
+            }
+
+            if (auto it = dir_watches.find(ev->wd); it != dir_watches.end() && ev->len > 0) {
+                for (size_t i : it->second) {
+                    FollowedFile& f = files[i];
+                    if (f.name != ev->name) continue;
+                    struct stat st;
+                    if (stat(f.path.c_str(), &st) != 0) continue;
+                    if (f.fd < 0 || st.st_dev != f.dev || st.st_ino != f.ino) {
+                        reopen(f);
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int run_follow(const Config& config, Shared& data)
+{
+    Follower follower(config, data);
+    return follower.run();
+}
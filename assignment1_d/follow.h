@@ -0,0 +1,17 @@
+#pragma once
+
+#include "config.h"
+#include "thread_safe.h"
+
+// -f/--follow: search the files once, then keep watching them (inotify) and
+// search only what gets appended, the way `tail -f | grep` would but without
+// a process per file. Each file remembers how far it has been read and the
+// bytes a match or line could still continue from, so nothing is searched
+// twice and matches across two writes are not lost.
+//
+// A file that shrinks is taken to have been truncated and is read again from
+// the start. A file that is renamed or deleted is read to its end, then the
+// name is watched until a new file shows up under it (log rotation).
+//
+// Runs until killed, or until -m N matches have been found.
+int run_follow(const Config& config, Shared& data);
@@ -0,0 +1,623 @@
+#include "input_source.h"
+#include "logger.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define HAVE_ZLIB 1
+#endif
+
+// zstd is opt-in, so that the usual build line does not need libzstd:
+// build with -DHAVE_ZSTD and link with -lzstd to read zstd input.
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+constexpr size_t COMPRESSED_CHUNK = 1 << 18;
+
+atomic<size_t> read_ahead_bytes{0};
+
+class FileSource : public InputSource {
+private:
+    int fd;
+    bool owned;
+    off_t offset = 0;
+    off_t advised_to = 0;
+    bool seekable = true;   // a pipe has nothing to read ahead
+
+    // Keeps the requested range read_ahead_bytes in front of the reader, in
+    // steps of at least a quarter of it so that it is not a call per read.
+    void read_ahead() {
+        size_t ahead = read_ahead_bytes.load(memory_order_relaxed);
+        if (ahead == 0 || !seekable) return;
+        off_t want = offset + static_cast<off_t>(ahead);
+        off_t from = max(offset, advised_to);
+        if (want - from < static_cast<off_t>(ahead / 4)) return;
+        if (posix_fadvise(fd, from, want - from, POSIX_FADV_WILLNEED) != 0) {
+            seekable = false;
+            return;
+        }
+        advised_to = want;
+    }
+
+public:
+    explicit FileSource(int fd, bool owned = true) : fd(fd), owned(owned) {}
+    ~FileSource() override { if (owned) close(fd); }
+
+    size_t read(char* buffer, size_t size) override {
+        read_ahead();
+        while (true) {
+            ssize_t got = ::read(fd, buffer, size);
+            if (got >= 0) {
+                offset += got;
+                return static_cast<size_t>(got);
+            }
+            if (errno != EINTR) throw runtime_error(string("read failed: ") + strerror(errno));
+        }
+    }
+};
+
+// Read-only mapping of a whole compressed file, so independent blocks can be
+// handed to different threads without copying them.
+struct Mapping {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+    Mapping(int fd, size_t size) : size(size) {
+        if (size == 0) return;
+        void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) throw runtime_error(string("mmap failed: ") + strerror(errno));
+        data = static_cast<const unsigned char*>(p);
+    }
+    ~Mapping() {
+        if (data) munmap(const_cast<unsigned char*>(data), size);
+    }
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+};
+
+struct Block {
+    size_t offset;
+    size_t length;
+};
+
+using BlockDecoder = vector<char> (*)(const unsigned char* data, size_t length);
+
+// Decode threads shared by every compressed input in the process, so the
+// number of threads stays the same however many files are searched at once.
+class DecodePool {
+public:
+    static DecodePool& get() {
+        static DecodePool pool;
+        return pool;
+    }
+
+    size_t size() const { return threads.size(); }
+
+    void submit(function<void()> job) {
+        {
+            lock_guard<mutex> lock(mtx);
+            jobs.push_back(std::move(job));
+        }
+        cv.notify_one();
+    }
+
+    ~DecodePool() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+private:
+    mutex mtx;
+    condition_variable cv;
+    deque<function<void()>> jobs;
+    bool stopping = false;
+    vector<thread> threads;
+
+    DecodePool() {
+        for (unsigned i = 0; i < max(1u, thread::hardware_concurrency()); i++) {
+            threads.emplace_back([this] { run(); });
+        }
+    }
+
+    void run() {
+        while (true) {
+            function<void()> job;
+            {
+                unique_lock<mutex> lock(mtx);
+                cv.wait(lock, [&] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+};
+
+// Decompresses independent blocks (BGZF members, zstd frames) on the
+// DecodePool. At most `window` blocks are decoded or waiting ahead of the
+// reader, which bounds memory to a few blocks no matter how large the file
+// is, while the reader consumes them strictly in order.
+class ParallelBlockSource : public InputSource {
+private:
+    struct Slot {
+        vector<char> data;
+        exception_ptr error;
+        bool ready = false;
+    };
+
+    unique_ptr<Mapping> mapping;
+    vector<Block> blocks;
+    BlockDecoder decode;
+    size_t window;
+
+    // Block i goes into slots[i % window]. Guarded by mtx.
+    vector<Slot> slots;
+    size_t next_block = 0;  // next one to hand to the pool
+    size_t taken = 0;       // blocks the reader has taken out of their slot
+    size_t in_flight = 0;   // handed to the pool and not finished yet
+    bool stopping = false;
+    mutex mtx;
+    condition_variable cv;
+
+    vector<char> current;
+    size_t current_pos = 0;
+
+    // With mtx held.
+    void launch_next() {
+        if (next_block == blocks.size()) return;
+        size_t index = next_block++;
+        in_flight++;
+        DecodePool::get().submit([this, index] { decode_block(index); });
+    }
+
+    void decode_block(size_t index) {
+        Slot done;
+        {
+            lock_guard<mutex> lock(mtx);
+            if (stopping) {
+                in_flight--;
+                cv.notify_all();
+                return;
+            }
+        }
+        try {
+            done.data = decode(mapping->data + blocks[index].offset, blocks[index].length);
+        } catch (...) {
+            done.error = current_exception();
+        }
+        done.ready = true;
+
+        lock_guard<mutex> lock(mtx);
+        slots[index % window] = std::move(done);
+        in_flight--;
+        cv.notify_all();
+    }
+
+public:
+    ParallelBlockSource(unique_ptr<Mapping> mapping, vector<Block> blocks, BlockDecoder decode)
+        : mapping(std::move(mapping)), blocks(std::move(blocks)), decode(decode),
+          window(2 * DecodePool::get().size()), slots(window)
+    {
+        lock_guard<mutex> lock(mtx);
+        for (size_t i = 0; i < window; i++) launch_next();
+    }
+
+    ~ParallelBlockSource() override {
+        // Jobs in the pool reference this object, they must be done with it
+        // first. The ones that have not started yet skip the decoding.
+        unique_lock<mutex> lock(mtx);
+        stopping = true;
+        cv.wait(lock, [&] { return in_flight == 0; });
+    }
+
+    size_t read(char* buffer, size_t size) override {
+        while (current_pos == current.size()) {
+            unique_lock<mutex> lock(mtx);
+            if (taken == blocks.size()) return 0;
+            Slot& slot = slots[taken % window];
+            cv.wait(lock, [&] { return slot.ready; });
+            if (slot.error) rethrow_exception(slot.error);
+            current = std::move(slot.data);
+            slot.ready = false;
+            taken++;
+            current_pos = 0;
+            launch_next();
+        }
+        size_t n = min(size, current.size() - current_pos);
+        memcpy(buffer, current.data() + current_pos, n);
+        current_pos += n;
+        return n;
+    }
+};
+
+// Double buffering for streams. A reader thread fills one block while the
+// searcher works on the other, so a slow producer on the other end of a pipe
+// and the search overlap instead of taking turns. Each block holds whatever
+// one read() returned, so on an interactive pipe a line is handed over as soon
+// as it arrives rather than when a whole block has filled up.
+class PrefetchSource : public InputSource {
+private:
+    static constexpr size_t BLOCK = 1 << 20;
+
+    // Shared with the reader thread, which may outlive this object if it is
+    // stuck in a read() on a pipe that never closes (see the destructor).
+    struct State {
+        unique_ptr<InputSource> inner;
+        vector<char> blocks[2];
+        size_t lengths[2] = {0, 0};
+        bool full[2] = {false, false};
+        bool stopping = false;
+        exception_ptr error;
+        mutex mtx;
+        condition_variable cv;
+    };
+
+    shared_ptr<State> state;
+    thread reader;
+    int current = -1;
+    size_t current_pos = 0;
+    bool finished = false;
+
+    static void read_loop(shared_ptr<State> st) {
+        for (int i = 0;; i ^= 1) {
+            {
+                unique_lock<mutex> lock(st->mtx);
+                st->cv.wait(lock, [&] { return !st->full[i] || st->stopping; });
+                if (st->stopping) return;
+            }
+
+            size_t n = 0;
+            exception_ptr error;
+            try {
+                n = st->inner->read(st->blocks[i].data(), BLOCK);
+            } catch (...) {
+                error = current_exception();
+            }
+
+            lock_guard<mutex> lock(st->mtx);
+            st->lengths[i] = n;
+            st->full[i] = true;
+            st->error = error;
+            st->cv.notify_all();
+            if (n == 0 || error) return;
+        }
+    }
+
+public:
+    explicit PrefetchSource(unique_ptr<InputSource> inner) : state(make_shared<State>()) {
+        state->inner = std::move(inner);
+        state->blocks[0].resize(BLOCK);
+        state->blocks[1].resize(BLOCK);
+        reader = thread(read_loop, state);
+    }
+
+    ~PrefetchSource() override {
+        {
+            lock_guard<mutex> lock(state->mtx);
+            state->stopping = true;
+            state->cv.notify_all();
+        }
+        // If we stopped early (-l, -m) the reader may be blocked on a pipe
+        // forever. It only touches the shared state, so let it go.
+        if (finished) reader.join();
+        else reader.detach();
+    }
+
+    size_t read(char* buffer, size_t size) override {
+        if (finished) return 0;
+
+        if (current < 0 || current_pos == state->lengths[current]) {
+            unique_lock<mutex> lock(state->mtx);
+            if (current >= 0) {
+                state->full[current] = false;
+                state->cv.notify_all();
+            }
+            current = current < 0 ? 0 : current ^ 1;
+            current_pos = 0;
+            state->cv.wait(lock, [&] { return state->full[current]; });
+            if (state->lengths[current] == 0) {
+                finished = true;
+                if (state->error) rethrow_exception(state->error);
+                return 0;
+            }
+        }
+
+        size_t n = min(size, state->lengths[current] - current_pos);
+        memcpy(buffer, state->blocks[current].data() + current_pos, n);
+        current_pos += n;
+        return n;
+    }
+};
+
+#ifdef HAVE_ZLIB
+
+// Ordinary gzip, possibly several members back to back. Members can only be
+// found by inflating up to them, so this one is sequential.
+class GzipStreamSource : public InputSource {
+private:
+    int fd;
+    string name;
+    z_stream zs{};
+    vector<unsigned char> in;
+    bool between_members = false;
+    bool stream_done = false;
+
+public:
+    GzipStreamSource(int fd, const string& name) : fd(fd), name(name), in(COMPRESSED_CHUNK) {
+        // 16 + MAX_WBITS: expect a gzip header.
+        if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {
+            close(fd);
+            throw runtime_error("inflateInit2 failed");
+        }
+    }
+    ~GzipStreamSource() override {
+        inflateEnd(&zs);
+        close(fd);
+    }
+
+    size_t read(char* buffer, size_t size) override {
+        zs.next_out = reinterpret_cast<Bytef*>(buffer);
+        zs.avail_out = static_cast<uInt>(min<size_t>(size, UINT32_MAX));
+        size_t asked = zs.avail_out;
+
+        while (zs.avail_out == asked && !stream_done) {
+            if (zs.avail_in == 0) {
+                ssize_t got = ::read(fd, in.data(), in.size());
+                if (got < 0) {
+                    if (errno == EINTR) continue;
+                    throw runtime_error(string("read failed: ") + strerror(errno));
+                }
+                if (got == 0) {
+                    // Running out of input is only fine between two members.
+                    if (!between_members) throw runtime_error("truncated gzip input");
+                    stream_done = true;
+                    break;
+                }
+                zs.next_in = in.data();
+                zs.avail_in = static_cast<uInt>(got);
+            }
+
+            if (between_members && (zs.next_in[0] != 0x1f || (zs.avail_in > 1 && zs.next_in[1] != 0x8b))) {
+                // Not another member. Like zcat, keep what was inflated and
+                // ignore the rest.
+                Logger::getInstance().logError("Warning: " + name + ": trailing garbage after the last gzip member ignored");
+                stream_done = true;
+                break;
+            }
+            between_members = false;
+            int rc = inflate(&zs, Z_NO_FLUSH);
+            if (rc == Z_STREAM_END) {
+                // Another member may follow this one.
+                between_members = true;
+                inflateReset(&zs);
+            } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+                throw runtime_error(string("gzip error: ") + (zs.msg ? zs.msg : "corrupt data"));
+            }
+        }
+        return size - zs.avail_out;
+    }
+};
+
+// BGZF (what bgzip and samtools write) is gzip where every member is at most
+// 64 KiB and records its own compressed size in a "BC" extra field, so the
+// file can be cut into members without inflating anything.
+bool bgzf_blocks(const unsigned char* d, size_t size, vector<Block>& blocks)
+{
+    size_t pos = 0;
+    while (pos < size) {
+        if (size - pos < 18 || d[pos] != 0x1f || d[pos + 1] != 0x8b || d[pos + 2] != 8 || !(d[pos + 3] & 4)) {
+            return false;
+        }
+        size_t xlen = d[pos + 10] | (d[pos + 11] << 8);
+        size_t field = pos + 12, extra_end = field + xlen;
+        size_t bsize = 0;
+        while (field + 4 <= extra_end && extra_end <= size) {
+            size_t slen = d[field + 2] | (d[field + 3] << 8);
+            if (d[field] == 'B' && d[field + 1] == 'C' && slen == 2 && field + 6 <= extra_end) {
+                bsize = (d[field + 4] | (d[field + 5] << 8)) + 1;
+                break;
+            }
+            field += 4 + slen;
+        }
+        if (bsize == 0 || pos + bsize > size) {
+            return false;
+        }
+        blocks.push_back({pos, bsize});
+        pos += bsize;
+    }
+    return !blocks.empty();
+}
+
+vector<char> inflate_bgzf_block(const unsigned char* data, size_t length)
+{
+    // ISIZE, the uncompressed size mod 2^32, is the last field of the member.
+    size_t isize = data[length - 4] | (data[length - 3] << 8) | (data[length - 2] << 16) | (size_t(data[length - 1]) << 24);
+    // One spare byte: zlib will not finish a stream into a zero-sized buffer,
+    // which is exactly what the empty BGZF end-of-file marker block asks for.
+    vector<char> out(isize + 1);
+
+    z_stream zs{};
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) throw runtime_error("inflateInit2 failed");
+    zs.next_in = const_cast<Bytef*>(data);
+    zs.avail_in = static_cast<uInt>(length);
+    zs.next_out = reinterpret_cast<Bytef*>(out.data());
+    zs.avail_out = static_cast<uInt>(out.size());
+    int rc = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (rc != Z_STREAM_END || zs.total_out != isize) throw runtime_error("corrupt BGZF block");
+    out.resize(isize);
+    return out;
+}
+
+#endif
+
+#ifdef HAVE_ZSTD
+
+// Frames up to this size are decoded whole on the workers. Anything larger,
+// or a frame that does not record its size, goes through ZstdStreamSource.
+constexpr unsigned long long MAX_PARALLEL_FRAME = 4 << 20;
+
+vector<char> decompress_zstd_frame(const unsigned char* data, size_t length)
+{
+    unsigned long long expected = ZSTD_getFrameContentSize(data, length);
+    if (expected == ZSTD_CONTENTSIZE_UNKNOWN || expected == ZSTD_CONTENTSIZE_ERROR || expected > MAX_PARALLEL_FRAME) {
+        throw runtime_error("zstd frame too large to decode in one piece");
+    }
+    vector<char> out(expected);
+    size_t rc = ZSTD_decompress(out.data(), out.size(), data, length);
+    if (ZSTD_isError(rc)) throw runtime_error(string("zstd error: ") + ZSTD_getErrorName(rc));
+    out.resize(rc);
+    return out;
+}
+
+// One frame after another, straight into the reader's buffer, so a frame is
+// never held in memory in full however large it is.
+class ZstdStreamSource : public InputSource {
+private:
+    unique_ptr<Mapping> mapping;
+    ZSTD_DCtx* ctx;
+    ZSTD_inBuffer in;
+    size_t frame_left = 0;  // 0 between frames, otherwise ZSTD_decompressStream's hint
+
+public:
+    explicit ZstdStreamSource(unique_ptr<Mapping> mapping)
+        : mapping(std::move(mapping)), ctx(ZSTD_createDCtx()), in{this->mapping->data, this->mapping->size, 0}
+    {
+        if (!ctx) throw runtime_error("ZSTD_createDCtx failed");
+    }
+    ~ZstdStreamSource() override { ZSTD_freeDCtx(ctx); }
+
+    size_t read(char* buffer, size_t size) override {
+        ZSTD_outBuffer out{buffer, size, 0};
+        // Once all input is in, the decoder may still hold output for the
+        // end of the last frame.
+        while (out.pos < out.size && (in.pos < in.size || frame_left != 0)) {
+            size_t in_before = in.pos, out_before = out.pos;
+            frame_left = ZSTD_decompressStream(ctx, &out, &in);
+            if (ZSTD_isError(frame_left)) throw runtime_error(string("zstd error: ") + ZSTD_getErrorName(frame_left));
+            if (in.pos == in_before && out.pos == out_before) throw runtime_error("truncated zstd input");
+        }
+        return out.pos;
+    }
+};
+
+// Cuts the file into its frames. Throws if it is not a sequence of complete
+// zstd frames, returns false if one of them is too large (or of unknown
+// size) to be decoded in one piece.
+bool zstd_frames(const unsigned char* d, size_t size, vector<Block>& blocks)
+{
+    bool small = true;
+    size_t pos = 0;
+    while (pos < size) {
+        size_t len = ZSTD_findFrameCompressedSize(d + pos, size - pos);
+        if (ZSTD_isError(len) || len == 0) throw runtime_error("corrupt zstd input");
+        unsigned long long content = ZSTD_getFrameContentSize(d + pos, len);
+        if (content == ZSTD_CONTENTSIZE_UNKNOWN || content == ZSTD_CONTENTSIZE_ERROR || content > MAX_PARALLEL_FRAME) {
+            small = false;
+        }
+        blocks.push_back({pos, len});
+        pos += len;
+    }
+    return small;
+}
+
+#endif
+
+} // namespace
+
+bool zstd_supported()
+{
+#ifdef HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+void set_read_ahead(size_t bytes)
+{
+    read_ahead_bytes.store(bytes, memory_order_relaxed);
+}
+
+unique_ptr<InputSource> open_input(const string& filename)
+{
+    if (filename == "-") {
+        return make_unique<PrefetchSource>(make_unique<FileSource>(STDIN_FILENO, false));
+    }
+
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw runtime_error(strerror(errno));
+    }
+
+    unsigned char magic[4] = {};
+    ssize_t got = pread(fd, magic, sizeof(magic), 0);
+    bool gzip = got >= 2 && magic[0] == 0x1f && magic[1] == 0x8b;
+    bool zstd = got >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd;
+
+    if (!gzip && !zstd) {
+        return make_unique<FileSource>(fd);
+    }
+
+    // The decompressing sources work from a mapping, which outlives the
+    // descriptor. Only GzipStreamSource keeps it.
+    struct Closer {
+        int fd;
+        ~Closer() { if (fd >= 0) close(fd); }
+    } closer{fd};
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        throw runtime_error(strerror(errno));
+    }
+
+    if (gzip) {
+#ifdef HAVE_ZLIB
+        auto mapping = make_unique<Mapping>(fd, st.st_size);
+        vector<Block> blocks;
+        if (bgzf_blocks(mapping->data, mapping->size, blocks)) {
+            return make_unique<ParallelBlockSource>(std::move(mapping), std::move(blocks), inflate_bgzf_block);
+        }
+        closer.fd = -1;
+        return make_unique<GzipStreamSource>(fd, filename);
+#else
+        throw runtime_error("gzip input, but built without zlib");
+#endif
+    }
+
+#ifdef HAVE_ZSTD
+    auto mapping = make_unique<Mapping>(fd, st.st_size);
+    vector<Block> blocks;
+    if (zstd_frames(mapping->data, mapping->size, blocks)) {
+        return make_unique<ParallelBlockSource>(std::move(mapping), std::move(blocks), decompress_zstd_frame);
+    }
+    return make_unique<ZstdStreamSource>(std::move(mapping));
+#else
+    throw runtime_error("zstd input, but built without libzstd (-DHAVE_ZSTD -lzstd)");
+#endif
+}
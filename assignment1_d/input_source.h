@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+// Where the bytes of an input come from. Plain files are read directly,
+// gzip and zstd inputs are decompressed on the fly, so the matcher always sees
+// plain text and nothing is ever inflated to disk or held in memory in full.
+//
+// gzip support needs zlib (link with -lz). zstd support is opt-in: it is
+// only compiled in when built with -DHAVE_ZSTD, and then needs libzstd
+// (-lzstd). Without it a zstd file is an error, see zstd_supported().
+class InputSource {
+public:
+    virtual ~InputSource() = default;
+
+    // Reads up to size bytes, returns 0 once the input is exhausted. May
+    // return less than asked for before the end. Throws std::runtime_error
+    // on I/O or decompression errors.
+    virtual size_t read(char* buffer, size_t size) = 0;
+
+    // Keeps reading until the buffer is full or the input ends.
+    size_t fill(char* buffer, size_t size) {
+        size_t total = 0;
+        while (total < size) {
+            size_t got = read(buffer + total, size - total);
+            if (got == 0) break;
+            total += got;
+        }
+        return total;
+    }
+};
+
+// Whether this build reads zstd input. --help says so.
+bool zstd_supported();
+
+// How many bytes of a plain file to request from the disk ahead of where it
+// is being read (posix_fadvise WILLNEED), for every file read from now on.
+// 0, the default, leaves read-ahead to the kernel's own heuristics.
+void set_read_ahead(size_t bytes);
+
+// Picks the right source by looking at the first bytes of the file, not at
+// its extension. "-" is standard input, read through a double buffer.
+// Throws std::runtime_error if the file cannot be opened.
+std::unique_ptr<InputSource> open_input(const std::string& filename);
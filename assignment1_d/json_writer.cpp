@@ -0,0 +1,257 @@
+#include "json_writer.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstring>
+using namespace std;
+
+namespace {
+
+enum ByteClass : uint8_t { PLAIN, ESCAPE, MULTIBYTE };
+
+constexpr array<uint8_t, 256> make_classes()
+{
+    array<uint8_t, 256> classes{};
+    for(int c = 0; c < 0x20; c++) classes[c] = ESCAPE;
+    classes['"'] = ESCAPE;
+    classes['\\'] = ESCAPE;
+    for(int c = 0x80; c < 0x100; c++) classes[c] = MULTIBYTE;
+    return classes;
+}
+
+constexpr array<uint8_t, 256> CLASSES = make_classes();
+
+// The letter after the backslash for the characters with a short escape,
+// 0 for the ones written as \u00XX.
+constexpr array<char, 256> make_short_escapes()
+{
+    array<char, 256> letters{};
+    letters['"'] = '"';
+    letters['\\'] = '\\';
+    letters['\n'] = 'n';
+    letters['\r'] = 'r';
+    letters['\t'] = 't';
+    letters['\b'] = 'b';
+    letters['\f'] = 'f';
+    return letters;
+}
+
+constexpr array<char, 256> SHORT_ESCAPES = make_short_escapes();
+
+constexpr uint64_t ONES = 0x0101010101010101ULL;
+constexpr uint64_t HIGH = 0x8080808080808080ULL;
+constexpr uint64_t LOW7 = 0x7f7f7f7f7f7f7f7fULL;
+
+// The top bit of every byte of w that is not PLAIN: a control character, a
+// quote, a backslash, or not ASCII. Exact per byte, nothing carries over
+// from one byte into the next.
+inline uint64_t attention(uint64_t w)
+{
+    auto zero = [](uint64_t x) { return ~(((x & LOW7) + LOW7) | x | LOW7); };
+    uint64_t control = ~((w & LOW7) + ONES * 0x60) & HIGH;
+    return (w & HIGH) | control | zero(w ^ (ONES * '"')) | zero(w ^ (ONES * '\\'));
+}
+
+// Length of the well-formed UTF-8 sequence at p (lead byte 0x80 or above),
+// 0 if it is not one. Overlong forms and surrogates are not well-formed.
+inline size_t sequence_length(const unsigned char* p, size_t left)
+{
+    auto cont = [&](size_t i, unsigned char lo = 0x80, unsigned char hi = 0xbf) {
+        return i < left && p[i] >= lo && p[i] <= hi;
+    };
+    unsigned char c = p[0];
+    if(c >= 0xc2 && c <= 0xdf) return cont(1) ? 2 : 0;
+    if(c >= 0xe0 && c <= 0xef) {
+        bool second = c == 0xe0 ? cont(1, 0xa0) : c == 0xed ? cont(1, 0x80, 0x9f) : cont(1);
+        return second && cont(2) ? 3 : 0;
+    }
+    if(c >= 0xf0 && c <= 0xf4) {
+        bool second = c == 0xf0 ? cont(1, 0x90) : c == 0xf4 ? cont(1, 0x80, 0x8f) : cont(1);
+        return second && cont(2) && cont(3) ? 4 : 0;
+    }
+    return 0;
+}
+
+}
+
+JsonWriter::JsonWriter(string& out)
+    : out(out), dst(out.data() + out.size()), limit(dst) {}
+
+// Makes sure `bytes` more can be written at dst.
+inline void JsonWriter::room(size_t bytes)
+{
+    if(static_cast<size_t>(limit - dst) < bytes) {
+        grow(bytes);
+    }
+}
+
+void JsonWriter::grow(size_t bytes)
+{
+    size_t used = dst - out.data();
+    out.resize(used + max<size_t>(bytes, 256));
+    dst = out.data() + used;
+    limit = out.data() + out.size();
+}
+
+inline void JsonWriter::put(string_view bytes)
+{
+    room(bytes.size());
+    memcpy(dst, bytes.data(), bytes.size());
+    dst += bytes.size();
+}
+
+JsonWriter& JsonWriter::begin(string_view type)
+{
+    put("{\"type\":\"");
+    put(type);
+    put("\"");
+    return *this;
+}
+
+JsonWriter& JsonWriter::text(string_view name, string_view value)
+{
+    key(name);
+    if(!utf8_string(value)) {
+        dst -= name.size() + 4;
+        put(",\"");
+        put(name);
+        put("_base64\":");
+        base64_string(value);
+    }
+    return *this;
+}
+
+JsonWriter& JsonWriter::number(string_view name, uint64_t value)
+{
+    key(name);
+    room(20);
+    dst = to_chars(dst, limit, value).ptr;
+    return *this;
+}
+
+JsonWriter& JsonWriter::flag(string_view name, bool value)
+{
+    key(name);
+    put(value ? "true" : "false");
+    return *this;
+}
+
+void JsonWriter::end()
+{
+    put("}\n");
+    out.resize(dst - out.data());
+}
+
+inline void JsonWriter::key(string_view name)
+{
+    room(name.size() + 4);
+    *dst++ = ',';
+    *dst++ = '"';
+    memcpy(dst, name.data(), name.size());
+    dst += name.size();
+    *dst++ = '"';
+    *dst++ = ':';
+}
+
+bool JsonWriter::utf8_string(string_view value)
+{
+    static constexpr char HEX[] = "0123456789abcdef";
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(value.data());
+    const size_t size = value.size();
+    // Room for the value as it is and its quotes. From here on there is
+    // always room for what is left of it plus the closing quote, only an
+    // escape can need more.
+    room(size + 2);
+    char* start = dst;
+    *dst++ = '"';
+
+    // The byte (or UTF-8 sequence) at i is not PLAIN.
+    auto special = [&](size_t& i) {
+        unsigned char c = p[i];
+        if(CLASSES[c] == MULTIBYTE) {
+            size_t length = sequence_length(p + i, size - i);
+            if(length == 0) {
+                return false;
+            }
+            memcpy(dst, p + i, length);
+            dst += length;
+            i += length;
+            return true;
+        }
+        if(static_cast<size_t>(limit - dst) < size - i + 6) {
+            size_t offset = start - out.data();
+            grow(size - i + 6 + size);
+            start = out.data() + offset;
+        }
+        dst[0] = '\\';
+        if(char letter = SHORT_ESCAPES[c]) {
+            dst[1] = letter;
+            dst += 2;
+        } else {
+            memcpy(dst + 1, "u00", 3);
+            dst[4] = HEX[c >> 4];
+            dst[5] = HEX[c & 15];
+            dst += 6;
+        }
+        i++;
+        return true;
+    };
+
+    // 8 bytes at a time: all of them are copied, and the cursor moves up to
+    // the first one that needs more than that.
+    size_t i = 0;
+    while(i + 8 <= size) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        memcpy(dst, &w, 8);
+        uint64_t mask = attention(w);
+        if(mask == 0) {
+            dst += 8;
+            i += 8;
+            continue;
+        }
+        size_t plain = countr_zero(mask) / 8;
+        dst += plain;
+        i += plain;
+        if(!special(i)) {
+            dst = start;
+            return false;
+        }
+    }
+    while(i < size) {
+        if(CLASSES[p[i]] == PLAIN) {
+            *dst++ = p[i++];
+        } else if(!special(i)) {
+            dst = start;
+            return false;
+        }
+    }
+    *dst++ = '"';
+    return true;
+}
+
+void JsonWriter::base64_string(string_view value)
+{
+    static constexpr char DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(value.data());
+    const size_t size = value.size();
+    room((size + 2) / 3 * 4 + 2);
+    *dst++ = '"';
+    size_t i = 0;
+    for(; i + 3 <= size; i += 3) {
+        uint32_t bits = p[i] << 16 | p[i + 1] << 8 | p[i + 2];
+        *dst++ = DIGITS[bits >> 18];
+        *dst++ = DIGITS[bits >> 12 & 63];
+        *dst++ = DIGITS[bits >> 6 & 63];
+        *dst++ = DIGITS[bits & 63];
+    }
+    if(i < size) {
+        uint32_t bits = p[i] << 16 | (i + 1 < size ? p[i + 1] << 8 : 0);
+        *dst++ = DIGITS[bits >> 18];
+        *dst++ = DIGITS[bits >> 12 & 63];
+        *dst++ = i + 1 < size ? DIGITS[bits >> 6 & 63] : '=';
+        *dst++ = '=';
+    }
+    *dst++ = '"';
+}
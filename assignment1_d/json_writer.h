@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Writes one JSON Lines record at a time onto the end of a string the caller
+// keeps, and reuses, for a whole batch of output. Nothing is allocated once
+// that string has grown to the batch size. The record is written through a
+// plain pointer into room made at the end of the string, which only takes
+// its real length again in end(): a string method call per piece of the
+// record would cost more than the writing itself. Strings are copied 8
+// bytes at a time up to the few bytes that need escaping.
+//
+// JSON text has to be UTF-8 and files need not be. A value that is not valid
+// UTF-8 is written base64-encoded instead, under its key with "_base64"
+// appended ("text_base64" rather than "text"), so no byte is ever lost or
+// changed.
+//
+// Keys are written as they are, they are expected to be plain literals.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out);
+
+    // {"type":"<type>"
+    JsonWriter& begin(std::string_view type);
+    JsonWriter& text(std::string_view key, std::string_view value);
+    JsonWriter& number(std::string_view key, uint64_t value);
+    JsonWriter& flag(std::string_view key, bool value);
+    // }\n, and the string is as long as what was written.
+    void end();
+
+private:
+    std::string& out;
+    char* dst;   // where the next byte goes
+    char* limit; // end of the room made so far
+
+    void room(size_t bytes);
+    void grow(size_t bytes);
+    void put(std::string_view bytes);
+    void key(std::string_view name);
+    // false, with nothing written, if the value is not valid UTF-8.
+    bool utf8_string(std::string_view value);
+    void base64_string(std::string_view value);
+};
@@ -12,7 +12,28 @@ Logger& Logger::getInstance() {
 
 void Logger::log(const std::string& message) {
     std::lock_guard<std::mutex> lock(log_mutex);
-    std::cout << "INFO: " << message << std::endl;
+    (info_to_stderr ? std::cerr : std::cout) << "INFO: " << message << std::endl;
+}
+
+void Logger::setInfoToStderr(bool on) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    info_to_stderr = on;
+}
+
+void Logger::print(const std::string& message) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::cout << message << '\n';
+}
+
+void Logger::write(std::string_view block) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::cout.write(block.data(), block.size());
+    std::cout.flush();
+}
+
+void Logger::logStats(const std::string& message) {
+    std::lock_guard<std::mutex> lock(log_mutex);
+    std::cerr << "STATS: " << message << std::endl;
 }
 
 void Logger::logError(const std::string& message) {
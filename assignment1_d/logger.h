@@ -2,6 +2,7 @@
 #include <iostream>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <memory>
 
 class Logger {
@@ -11,11 +12,21 @@ public:
 
     static Logger& getInstance();
     void log(const std::string& message);
+    // Sends log() to stderr instead, for runs whose stdout is a result that
+    // INFO lines would corrupt (the --dry-run diff).
+    void setInfoToStderr(bool on);
+    // Plain stdout output, for results that other tools consume.
+    void print(const std::string& message);
+    // A ready-made block of output lines, written and flushed as one piece.
+    void write(std::string_view block);
     void logError(const std::string& message);
+    // Diagnostics asked for with --stats, on stderr so results stay clean.
+    void logStats(const std::string& message);
 private:
     Logger() = default;
 
     std::mutex log_mutex;
+    bool info_to_stderr = false;
     static std::unique_ptr<Logger> instance;
     static std::once_flag flag;
 };
\ No newline at end of file
@@ -8,7 +8,18 @@
 #include "file_processor.h"
 #include "thread_safe.h"
 #include "logger.h"
+#include "word_counter.h"
+#include "arguments.h"
+#include "server.h"
+#include "follow.h"
+#include "replace.h"
+#include "adaptive_pool.h"
+#include "placement.h"
+#include "scheduler.h"
+#include "input_source.h"
+#include <optional>
 #include <shared_mutex>
+#include <algorithm>
 
 using namespace std;
 
@@ -18,15 +29,45 @@ void print_usage(const string& program_name)
     Logger::getInstance().logError("USAGE:");
     Logger::getInstance().logError("  " + program_name + " [OPTIONS] <pattern> <file1> [file2]...");
     Logger::getInstance().logError("  " + program_name + " [OPTIONS] -r <replacement> <pattern> <file1> [file2]...");
+    Logger::getInstance().logError("  " + program_name + " [OPTIONS] --rules <rules.tsv> <file1> [file2]...");
+    Logger::getInstance().logError("  " + program_name + " [OPTIONS] --wordcount <file1> [file2]...");
+    Logger::getInstance().logError("  A file name of - reads standard input.");
+    Logger::getInstance().logError("  gzip files are read as they are. zstd files too, but only in a build with");
+    Logger::getInstance().logError(string("  -DHAVE_ZSTD -lzstd (this one ") + (zstd_supported() ? "has it)." : "does not)."));
     Logger::getInstance().logError("OPTIONS:");
     Logger::getInstance().logError("   -r, --replace <TEXT>   Enable find-and-replace mode.");
+    Logger::getInstance().logError("   --rules <FILE>         Replace with every pattern<TAB>replacement line of FILE in one pass.");
+    Logger::getInstance().logError("   --in-place             With -r and a replacement as long as the pattern: overwrite");
+    Logger::getInstance().logError("                          just the matched bytes. Faster, but not crash-safe.");
+    Logger::getInstance().logError("   --dry-run              With -r: print a unified diff of the replacements, change nothing.");
+    Logger::getInstance().logError("   -p, --print-lines      Print every matching line.");
+    Logger::getInstance().logError("   -o, --only-matching    Print each match on its own line, with its byte offset.");
+    Logger::getInstance().logError("   -A/-B/-C <N>           Print N lines of context after/before/around each match.");
     Logger::getInstance().logError("   -i, --ignore-case      Perform case-insensitive matching.");
     Logger::getInstance().logError("   -n, --line-number      Prefix each line of output with its line number.");
     Logger::getInstance().logError("   -v, --invert-match     Select non-matching lines.");
+    Logger::getInstance().logError("   -c, --count            Print the number of matches in each file.");
+    Logger::getInstance().logError("   -l, --files-with-matches  Print only the names of files with a match.");
+    Logger::getInstance().logError("   --top <N>              Print the N files with the most matches.");
+    Logger::getInstance().logError("   -I                     Skip binary files (NUL byte in the first block).");
+    Logger::getInstance().logError("   -a, --text             Search binary files as if they were text.");
+    Logger::getInstance().logError("   --wordcount            Count word frequencies instead of searching (top 20, or --top N).");
+    Logger::getInstance().logError("   -m, --max-count <N>    Stop all workers once N matches have been found.");
+    Logger::getInstance().logError("   --first                Stop at the first match (same as -m 1).");
+    Logger::getInstance().logError("   -f, --follow           Keep watching the files and search what gets appended.");
+    Logger::getInstance().logError("   --serve <PATH>         Keep running and answer search requests on a Unix socket.");
+    Logger::getInstance().logError("   --pin                  Pin workers to CPUs, files to the NUMA node that caches them.");
+    Logger::getInstance().logError("   --numa-buffers <MODE>  Search buffers on the worker's node (local) or spread (interleave).");
+    Logger::getInstance().logError("   --json                 Print JSON Lines: a record per match, per file, and a summary.");
+    Logger::getInstance().logError("   --stats                Print the worker count and read-ahead the pool settled on (stderr).");
     Logger::getInstance().logError("   -h, --help             Display this help message.");
 }
 
-void reporter(Shared& data){
+// With only_changes the total is printed when it moved, --follow would
+// otherwise repeat the same number forever.
+void reporter(Shared& data, bool only_changes){
+    size_t last = 0;
+    bool first = true;
     while (true) {
         
         std::shared_lock<std::shared_mutex> lock(data.data_mtx);
@@ -39,7 +80,11 @@ void reporter(Shared& data){
         
         lock.unlock();
 
-        Logger::getInstance().log("Total occurrences found so far: " + std::to_string(total)); 
+        if(!only_changes || first || total != last) {
+            Logger::getInstance().log("Total occurrences found so far: " + std::to_string(total));
+        }
+        first = false;
+        last = total;
 
         this_thread::sleep_for(chrono::milliseconds(100));
     }
@@ -57,50 +102,11 @@ int main(int argc, char* argv[])
     vector<string> args(argv + 1, argv + argc);
 
     try{
-        size_t i = 0;
-        while(i < args.size())
+        if(!parse_arguments(args, config))
         {
-            const string& arg = args[i];
-            if(arg == "-h" || arg == "--help")
-            {
-                print_usage(argv[0]);
-                return 0;
-            } 
-            else if (arg == "-i" || arg == "--ignore-case") {
-                config.ignore_case = true;
-                i++;
-            } 
-            else if (arg == "-n" || arg == "--line-number") {
-                config.line_number = true;
-                i++;
-            } 
-            else if (arg == "-v" || arg == "--invert-match") {
-                config.invert_match = true;
-                i++;
-            } 
-            else if (arg == "-r" || arg == "--replace") {
-                config.replace_mode = true;
-                if(i+1 >= args.size()) 
-                    throw runtime_error("Missing replacement text after " + arg);
-                config.replacement = args[i+1];
-                i += 2;
-            } else if(arg[0] == '-')
-            {
-                throw runtime_error("Unknown flag: " + arg);
-            }
-            else {
-                if(config.pattern.empty())
-                {
-                    config.pattern = arg;
-                } else {
-                    config.files.push_back(arg);
-                }
-                i++;
-            }
+            print_usage(argv[0]);
+            return 0;
         }
-
-        if (config.pattern.empty()) throw runtime_error("Pattern not specified.");
-        if (config.files.empty()) throw runtime_error("No input files specified."); 
     } 
     catch (const exception& e)
     {
@@ -109,38 +115,139 @@ int main(int argc, char* argv[])
         return 1;
     }
     
+    if(!config.serve_socket.empty()) {
+        return run_server(config.serve_socket);
+    }
+
     auto start_pool = chrono::high_resolution_clock::now();
-    vector<thread> threads;
     Shared shared_data;
+    // One table per worker, merged once they are all done.
+    vector<WordTable> word_tables(config.word_count ? config.files.size() : 0);
 
-    thread reporter_thread(reporter, ref(shared_data));
+    int status = 0;
+    optional<RuleSet> rules;
+    optional<ReplaceTransaction> transaction;
+    // A dry run is a search whose matching lines are printed as a diff.
+    // Like the real replace it matches case-sensitively, and -C picks how
+    // much context the hunks get.
+    Config preview = config;
+    if(config.dry_run)
+    {
+        // stdout is the diff, so progress and totals go to stderr.
+        Logger::getInstance().setInfoToStderr(true);
+        preview.print_lines = true;
+        preview.ignore_case = false;
+        preview.invert_match = false;
+        preview.only_matching = false;
+        preview.line_number = false;
+        if(config.before_context == 0 && config.after_context == 0) {
+            preview.before_context = preview.after_context = 3;
+        }
+    }
+    else if(config.replace_mode)
+    {
+        if(!ReplaceTransaction::recover()) {
+            return 1;
+        }
+        if(!config.rules_file.empty()) {
+            try {
+                rules.emplace(load_rules(config.rules_file));
+            } catch (const exception& e) {
+                Logger::getInstance().logError("Error: " + string(e.what()));
+                return 1;
+            }
+        }
+        if(!config.in_place) {
+            transaction.emplace(config, rules ? &*rules : nullptr);
+        }
+    }
 
-    for(const auto& file : config.files)
+    thread reporter_thread;
+    if(!config.listing_mode()) {
+        reporter_thread = thread(reporter, ref(shared_data), config.follow);
+    }
+
+    if(config.follow)
     {
-        try {
-            if(config.replace_mode)
-            {
-                execute_replace(file, config);
+        // Only returns once -m is satisfied or something went wrong.
+        status = run_follow(config, shared_data);
+    }
+    else
+    {
+        // Longest jobs first, on as many workers as the controller finds pays off.
+        WorkPlan plan(config);
+        const auto& items = plan.items();
+        AdaptivePool pool(shared_data, items.size());
+        if(config.pin_workers) {
+            vector<int> home(config.files.size());
+            for(size_t i = 0; i < home.size(); i++) {
+                home[i] = file_home_node(config.files[i]);
             }
-            else
-            {
-        //      auto start_time = chrono::high_resolution_clock::now();
-              threads.emplace_back(execute_search, file, ref(config), ref(shared_data));
-        //      auto end_time = chrono::high_resolution_clock::now();
-        //      chrono::duration<double, milli> elapsed = end_time - start_time;
-        //      cout << "\n--- Processed " << file << " in " << elapsed.count() << " ms. ---" << endl;
+            vector<int> item_home;
+            for(const auto& item : items) {
+                item_home.push_back(home[item.file]);
             }
+            pool.pin(item_home);
         }
-        catch (const exception& e)
-        {
-            Logger::getInstance().logError("Error processing file " + file + ": " + e.what());
+        pool.run([&](size_t j) {
+            const WorkItem& item = items[j];
+            const size_t i = item.file;
+            const string& file = config.files[i];
+            try {
+                if(item.piece)
+                {
+                    plan.search_piece(item, config, shared_data);
+                }
+                else if(config.dry_run)
+                {
+                    execute_search(file, preview, shared_data);
+                }
+                else if(config.in_place)
+                {
+                    auto replaced = replace_in_place(file, config);
+                    std::unique_lock<std::shared_mutex> data_lock(shared_data.data_mtx);
+                    if(replaced) shared_data.total_occ += *replaced;
+                    else status = 1;
+                }
+                else if(config.replace_mode)
+                {
+                    transaction->stage(file);
+                }
+                else if(config.word_count)
+                {
+                    execute_wordcount(file, config, word_tables[i], shared_data);
+                }
+                else
+                {
+                    execute_search(file, config, shared_data);
+                }
+            }
+            catch (const exception& e)
+            {
+                Logger::getInstance().logError("Error processing file " + file + ": " + e.what());
+                shared_data.failed = true;
+            }
+        });
+
+        if(config.stats) {
+            auto stats = pool.stats();
+            Logger::getInstance().logStats("workers " + std::to_string(stats.workers) + " of " + std::to_string(stats.max_workers) +
+                                           ", read-ahead " + (stats.read_ahead_mb ? std::to_string(stats.read_ahead_mb) + " MB" : string("kernel default")));
+            Logger::getInstance().logStats("best throughput " + std::to_string(static_cast<long long>(stats.best_mb_per_s)) + " MB/s, iowait " +
+                                           std::to_string(static_cast<int>(stats.iowait * 100)) + "%");
+            Logger::getInstance().logStats(std::to_string(items.size()) + " jobs, " + std::to_string(plan.split_files()) + " files split into pieces");
+            Logger::getInstance().logStats(std::to_string(stats.epochs) + " epochs, " + std::to_string(stats.moves_kept) + " moves kept, " +
+                                           std::to_string(stats.moves_undone) + " undone");
         }
     }
 
-    for(auto& t: threads) {
-        if(t.joinable()){
-            t.join();
+    // Nothing is replaced until every file has been rewritten.
+    if(transaction) {
+        if(!transaction->commit()) {
+            status = 1;
         }
+        std::unique_lock<std::shared_mutex> data_lock(shared_data.data_mtx);
+        shared_data.total_occ = transaction->replacements();
     }
 
     {
@@ -155,8 +262,53 @@ int main(int argc, char* argv[])
     auto end_pool = chrono::high_resolution_clock::now();
     
     chrono::duration<double, milli> elapsed = end_pool - start_pool;
+
+    // A file that could not be read in full still counts what it had, but
+    // the run is not a success.
+    if(shared_data.failed) {
+        status = 1;
+    }
+
+    if(config.word_count) {
+        unsigned mergers = max(1u, thread::hardware_concurrency());
+        print_word_counts(word_tables, config, mergers, shared_data);
+        return status;
+    }
+
+    if(config.dry_run) {
+        auto results = shared_data.results.snapshot();
+        for(const auto& r : results) {
+            if(r.count > 0) Logger::getInstance().log("Would replace " + std::to_string(r.count) + " occurrences in " + r.filename);
+        }
+        Logger::getInstance().log("Total occurrences that would be replaced: " + std::to_string(shared_data.total_occ));
+        return status;
+    }
+
+    if(config.listing_mode() && !config.replace_mode) {
+        print_file_stats(config, shared_data);
+        return status;
+    }
+
+    if(rules) {
+        for(size_t i = 0; i < rules->size(); i++) {
+            const Rule& r = rules->rule(i);
+            Logger::getInstance().log("Rule " + std::to_string(i + 1) + " (" + r.pattern + " -> " + r.replacement + "): " +
+                                      std::to_string(transaction->rule_hits()[i]) + " replacements");
+        }
+    }
     Logger::getInstance().log("Total occurrences found: " + std::to_string(shared_data.total_occ));
+    if(shared_data.stop.stop_requested()) {
+        Logger::getInstance().log("Stopped early after reaching the limit of " + std::to_string(config.max_count) + " matches.");
+    }
+    if(!config.replace_mode && !config.follow) {
+        size_t matched = 0;
+        auto results = shared_data.results.snapshot();
+        for(const auto& r : results) {
+            if(r.count > 0) matched++;
+        }
+        Logger::getInstance().log("Files with matches: " + std::to_string(matched) + " of " + std::to_string(results.size()));
+    }
     Logger::getInstance().log("Finished processing files in " + std::to_string(elapsed.count()) + " ms.");
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,186 @@
+#include "placement.h"
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+using namespace std;
+
+BufferPolicy parse_buffer_policy(const string& name)
+{
+    if (name.empty()) return BufferPolicy::Default;
+    if (name == "local") return BufferPolicy::Local;
+    if (name == "interleave") return BufferPolicy::Interleave;
+    throw runtime_error("Unknown buffer placement: " + name + " (expected local or interleave)");
+}
+
+// "0-3,8-11" as a list of numbers.
+static vector<int> parse_list(const string& text)
+{
+    vector<int> values;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find(',', pos);
+        if (end == string::npos) end = text.size();
+        string range = text.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        try {
+            int first = stoi(range.substr(0, dash));
+            int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+            for (int v = first; v <= last; v++) values.push_back(v);
+        } catch (const exception&) {
+            // a trailing newline or an empty list
+        }
+        pos = end + 1;
+    }
+    return values;
+}
+
+static string read_line(const string& path)
+{
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    return line;
+}
+
+const NumaTopology& NumaTopology::get()
+{
+    static const NumaTopology topology = [] {
+        NumaTopology t;
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        for (int node : parse_list(read_line("/sys/devices/system/node/online"))) {
+            vector<int> cpus;
+            for (int cpu : parse_list(read_line("/sys/devices/system/node/node" + to_string(node) + "/cpulist"))) {
+                if (!have_mask || CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+            }
+            // Memory-only nodes and nodes we may not run on have no workers.
+            if (!cpus.empty()) {
+                t.node_cpus.push_back(cpus);
+                t.node_ids.push_back(node);
+            }
+        }
+        if (t.node_cpus.empty()) {
+            vector<int> cpus;
+            unsigned n = max(1u, thread::hardware_concurrency());
+            for (unsigned cpu = 0; cpu < n; cpu++) cpus.push_back(cpu);
+            t.node_cpus.push_back(cpus);
+            t.node_ids.push_back(0);
+        }
+        return t;
+    }();
+    return topology;
+}
+
+int NumaTopology::cpu_for(size_t index) const
+{
+    const vector<int>& cpus = node_cpus[index % nodes()];
+    return cpus[(index / nodes()) % cpus.size()];
+}
+
+int NumaTopology::node_of(int cpu) const
+{
+    for (size_t n = 0; n < nodes(); n++) {
+        if (find(node_cpus[n].begin(), node_cpus[n].end(), cpu) != node_cpus[n].end()) return n;
+    }
+    return 0;
+}
+
+bool pin_current_thread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+int file_home_node(const string& filename)
+{
+    const NumaTopology& topology = NumaTopology::get();
+    if (topology.nodes() <= 1) {
+        return topology.nodes() == 1 ? 0 : -1;
+    }
+
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+    void* map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    // Only pages that are cached already are looked at. Touching one maps
+    // it into our address space, which move_pages() needs to see its node,
+    // and costs a minor fault, no I/O.
+    static constexpr size_t SAMPLES = 64;
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t pages = (size + page - 1) / page;
+    vector<unsigned char> resident(pages);
+    vector<void*> sampled;
+    if (mincore(map, size, resident.data()) == 0) {
+        for (size_t i = 0; i < SAMPLES && i < pages; i++) {
+            size_t p = i * pages / min(SAMPLES, pages);
+            if (!(resident[p] & 1)) continue;
+            char* addr = static_cast<char*>(map) + p * page;
+            *static_cast<volatile char*>(addr);
+            sampled.push_back(addr);
+        }
+    }
+
+    int home = -1;
+    if (!sampled.empty()) {
+        vector<int> status(sampled.size(), -1);
+        if (syscall(SYS_move_pages, 0, sampled.size(), sampled.data(), nullptr, status.data(), 0) == 0) {
+            vector<size_t> votes(topology.nodes());
+            for (int node : status) {
+                auto it = find(topology.node_ids.begin(), topology.node_ids.end(), node);
+                if (it != topology.node_ids.end()) votes[it - topology.node_ids.begin()]++;
+            }
+            auto best = max_element(votes.begin(), votes.end());
+            if (*best > 0) home = best - votes.begin();
+        }
+    }
+    munmap(map, size);
+    return home;
+}
+
+void place_buffer(void* data, size_t size, BufferPolicy policy)
+{
+    const NumaTopology& topology = NumaTopology::get();
+    if (topology.nodes() <= 1 || size == 0) {
+        return;
+    }
+    // mbind() works on whole pages.
+    const uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = reinterpret_cast<uintptr_t>(data) & ~(page - 1);
+    uintptr_t end = (reinterpret_cast<uintptr_t>(data) + size + page - 1) & ~(page - 1);
+
+    unsigned long mask[16] = {};
+    const unsigned long max_node = sizeof(mask) * 8;
+    // Default drops whatever binding an earlier call made.
+    int mode = policy == BufferPolicy::Default ? MPOL_DEFAULT : MPOL_LOCAL;
+    if (policy == BufferPolicy::Interleave) {
+        mode = MPOL_INTERLEAVE;
+        for (int node : topology.node_ids) {
+            if (static_cast<unsigned long>(node) < max_node) mask[node / 64] |= 1UL << (node % 64);
+        }
+    }
+    syscall(SYS_mbind, start, end - start, mode, mode == MPOL_INTERLEAVE ? mask : nullptr, max_node,
+            mode == MPOL_DEFAULT ? 0 : MPOL_MF_MOVE);
+}
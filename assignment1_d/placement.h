@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Where threads, files and buffers sit on a NUMA machine. Everything here
+// talks to the kernel directly (sysfs, sched affinity, move_pages, mbind),
+// so there is nothing extra to link. On a single-node machine, or where a
+// call is not allowed, it all quietly does nothing.
+
+enum class BufferPolicy {
+    Default,     // whatever the allocating thread's policy is
+    Local,       // on the node of the thread that uses the buffer
+    Interleave,  // page by page over all nodes
+};
+
+// Parses the argument of --numa-buffers ("local" or "interleave", empty
+// for the default). Throws runtime_error.
+BufferPolicy parse_buffer_policy(const std::string& name);
+
+// Node of every online CPU, from /sys/devices/system/node.
+struct NumaTopology {
+    // Only nodes with CPUs we may run on. Functions here speak of a node by
+    // its index in these lists, node_ids has the kernel's number for it.
+    std::vector<std::vector<int>> node_cpus;
+    std::vector<int> node_ids;
+
+    size_t nodes() const { return node_cpus.size(); }
+    // The CPU for worker `index`, going round the nodes first so that the
+    // first few workers are spread over all of them.
+    int cpu_for(size_t index) const;
+    int node_of(int cpu) const;
+
+    static const NumaTopology& get();
+};
+
+// Pins the calling thread to one CPU. Returns false if that is not allowed.
+bool pin_current_thread(int cpu);
+
+// The node (index) that holds most of the file's pages in the page cache,
+// sampled without reading anything in, or -1 if none of them are cached.
+int file_home_node(const std::string& filename);
+
+// Applies the policy to the pages of [data, data + size), moving the ones
+// already touched. Default undoes an earlier call, leaving the pages where
+// they are. Call it from the thread that will use the buffer.
+void place_buffer(void* data, size_t size, BufferPolicy policy);
@@ -0,0 +1,555 @@
+#include "replace.h"
+#include "logger.h"
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+using namespace std;
+
+static constexpr size_t CHUNK_SIZE = 1 << 20;
+
+static bool write_all(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// "dir/" and "name" of a path, dir is empty for a file in the current directory.
+static pair<string, string> split_path(const string& path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == string::npos) return {"", path};
+    return {path.substr(0, slash + 1), path.substr(slash + 1)};
+}
+
+// Where journals go, created if need be. Empty if there is no home to put
+// it in.
+static string journal_dir()
+{
+    string base;
+    if (const char* state = getenv("XDG_STATE_HOME"); state && *state == '/') {
+        base = state;
+    } else if (const char* home = getenv("HOME"); home && *home) {
+        base = string(home) + "/.local/state";
+    } else {
+        return "";
+    }
+    string dir = base + "/grep-replace";
+    // Each level, like mkdir -p. Only the last one has to be private.
+    for (size_t slash = 1; (slash = dir.find('/', slash)) != string::npos; slash++) {
+        mkdir(dir.substr(0, slash).c_str(), 0755);
+    }
+    if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+        return "";
+    }
+    return dir;
+}
+
+static string absolute(const string& path)
+{
+    if (path.empty() || path[0] == '/') return path;
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) return path;
+    return string(cwd) + "/" + path;
+}
+
+// One syncfs() per file system makes everything written or renamed on it
+// durable, which for many files is far cheaper than an fsync each.
+static bool sync_filesystems(const vector<string>& paths)
+{
+    set<dev_t> done;
+    for (const auto& path : paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !done.insert(st.st_dev).second) {
+            continue;
+        }
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || syncfs(fd) != 0) {
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        close(fd);
+    }
+    return true;
+}
+
+ReplaceTransaction::ReplaceTransaction(const Config& config, const RuleSet* rules)
+    : config(config), rules(rules), hits(rules ? rules->size() : 0)
+{
+}
+
+ReplaceTransaction::~ReplaceTransaction()
+{
+    if (!finished) {
+        discard();
+    }
+}
+
+void ReplaceTransaction::discard()
+{
+    for (const auto& e : staged) {
+        unlink(e.temp.c_str());
+    }
+    staged.clear();
+}
+
+size_t ReplaceTransaction::stage(const string& filename)
+{
+    // The journal is line and tab separated.
+    if (filename.find_first_of("\t\n") != string::npos) {
+        Logger::getInstance().logError("Warning: Skipping file with a tab or newline in its name: " + filename);
+        return 0;
+    }
+
+    int in = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in < 0 || fstat(in, &st) != 0 || !S_ISREG(st.st_mode)) {
+        Logger::getInstance().logError("Warning: Could not open file for reading: " + filename);
+        if (in >= 0) close(in);
+        return 0;
+    }
+
+    auto [dir, name] = split_path(filename);
+    string temp = dir + "." + name + ".grep-XXXXXX";
+    int out = mkstemp(temp.data());
+    if (out < 0) {
+        Logger::getInstance().logError("Error: Could not create temporary file for " + filename + ": " + strerror(errno));
+        close(in);
+        lock_guard<mutex> lock(mtx);
+        failed = true;
+        return 0;
+    }
+    // The new file replaces the old one, so it gets its permissions and, if
+    // we are allowed to, its owner.
+    fchmod(out, st.st_mode & 07777);
+    if (fchown(out, st.st_uid, st.st_gid) != 0) {
+        // Only root can give files away, keeping our own ownership is fine.
+    }
+
+    const string& pattern = config.pattern;
+    const size_t keep = rules ? rules->longest() : pattern.empty() ? 0 : pattern.size() - 1;
+    vector<char> buffer(CHUNK_SIZE + keep);
+    vector<size_t> file_hits(hits.size());
+    string output;
+    output.reserve(2 * CHUNK_SIZE);
+    size_t carry = 0;
+    size_t count = 0;
+    bool ok = true;
+
+    while (ok) {
+        ssize_t got = ::read(in, buffer.data() + carry, buffer.size() - carry);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) { ok = false; break; }
+        size_t filled = carry + got;
+        bool done = got == 0;
+
+        size_t resume;
+        if (rules) {
+            resume = rules->rewrite(buffer.data(), filled, done, output, file_hits);
+        } else {
+            string_view view(buffer.data(), filled);
+            size_t last_pos = 0, find_pos;
+            while (!pattern.empty() && (find_pos = view.find(pattern, last_pos)) != string_view::npos) {
+                output.append(view.data() + last_pos, find_pos - last_pos);
+                output += config.replacement;
+                last_pos = find_pos + pattern.size();
+                count++;
+            }
+            // Up to pattern.size() - 1 bytes may start a match that ends in the next chunk.
+            resume = done ? filled : max(filled > keep ? filled - keep : 0, last_pos);
+            output.append(view.data() + last_pos, resume - last_pos);
+        }
+
+        if (output.size() >= CHUNK_SIZE || done) {
+            ok = write_all(out, output.data(), output.size());
+            output.clear();
+        }
+        carry = filled - resume;
+        memmove(buffer.data(), buffer.data() + resume, carry);
+        if (done) break;
+    }
+    close(in);
+    close(out);
+    for (size_t h : file_hits) count += h;
+
+    if (!ok) {
+        Logger::getInstance().logError("Error: Could not rewrite " + filename + ": " + strerror(errno));
+        unlink(temp.c_str());
+        lock_guard<mutex> lock(mtx);
+        failed = true;
+        return 0;
+    }
+    if (count == 0) {
+        unlink(temp.c_str());
+        Logger::getInstance().log("No matches found in: " + filename);
+        return 0;
+    }
+
+    lock_guard<mutex> lock(mtx);
+    staged.push_back(Entry{filename, temp, string()});
+    total += count;
+    for (size_t i = 0; i < hits.size(); i++) hits[i] += file_hits[i];
+    return count;
+}
+
+bool ReplaceTransaction::commit()
+{
+    finished = true;
+    if (failed) {
+        Logger::getInstance().logError("Error: Not replacing anything, some files could not be rewritten.");
+        discard();
+        return false;
+    }
+    if (staged.empty()) {
+        return true;
+    }
+
+    // The journal is created under a name recover() does not look at, locked,
+    // and only then linked to its real name, so a concurrent recover() never
+    // sees it unlocked or half written. The lock is held until we are done.
+    string dir = journal_dir();
+    string journal_path = dir + "/" + to_string(getpid()) + ".journal";
+    string pending = dir + "/.pending-XXXXXX";
+    errno = ENOENT;
+    int journal = dir.empty() ? -1 : mkstemp(pending.data());
+    bool named = false;
+    if (journal >= 0) {
+        named = flock(journal, LOCK_EX) == 0 && link(pending.c_str(), journal_path.c_str()) == 0;
+        int err = errno;
+        unlink(pending.c_str());
+        errno = err;
+    }
+    if (!named) {
+        Logger::getInstance().logError("Error: Could not create the journal " + journal_path + ": " + strerror(errno));
+        if (journal >= 0) close(journal);
+        discard();
+        return false;
+    }
+
+    auto abort = [&](const string& why, size_t renamed) {
+        Logger::getInstance().logError("Error: " + why + ", restoring the original files.");
+        for (size_t i = 0; i < staged.size(); i++) {
+            const Entry& e = staged[i];
+            if (i < renamed) {
+                rename(e.backup.c_str(), e.target.c_str());
+            }
+            if (!e.backup.empty()) unlink(e.backup.c_str());
+            unlink(e.temp.c_str());
+        }
+        staged.clear();
+        unlink(journal_path.c_str());
+        close(journal);
+        return false;
+    };
+
+    // A second name for every original, so that any of them can be put
+    // back without having to copy anything.
+    string record;
+    vector<string> touched;
+    for (size_t i = 0; i < staged.size(); i++) {
+        Entry& e = staged[i];
+        auto [dir, name] = split_path(e.target);
+        string backup = dir + "." + name + ".grep-orig-" + to_string(getpid()) + "-" + to_string(i);
+        if (link(e.target.c_str(), backup.c_str()) != 0) {
+            return abort("Could not make a backup link of " + e.target + ": " + strerror(errno), 0);
+        }
+        e.backup = backup;
+        record += absolute(e.target) + "\t" + absolute(e.temp) + "\t" + absolute(e.backup) + "\n";
+        touched.push_back(e.temp);
+    }
+    touched.push_back(journal_path);
+
+    // Temps, backups and journal are all on disk before the first rename.
+    if (!write_all(journal, record.data(), record.size()) || fdatasync(journal) != 0 || !sync_filesystems(touched)) {
+        return abort("Could not write " + journal_path, 0);
+    }
+
+    for (size_t i = 0; i < staged.size(); i++) {
+        if (rename(staged[i].temp.c_str(), staged[i].target.c_str()) != 0) {
+            return abort("Could not rename over " + staged[i].target + ": " + strerror(errno), i);
+        }
+    }
+
+    vector<string> targets;
+    for (const auto& e : staged) targets.push_back(e.target);
+    if (!sync_filesystems(targets) || !write_all(journal, "commit\n", 7) || fdatasync(journal) != 0) {
+        return abort("Could not make the replaced files durable", staged.size());
+    }
+
+    // Committed. From here on a crash only leaves garbage for recover() to clean up.
+    for (const auto& e : staged) {
+        unlink(e.backup.c_str());
+        Logger::getInstance().log("Replaced matches in: " + e.target);
+    }
+    unlink(journal_path.c_str());
+    close(journal);
+    staged.clear();
+    return true;
+}
+
+// Finishes or undoes the transaction of one journal, unless its run is
+// still going.
+static void recover_journal(const string& path)
+{
+    int journal = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (journal < 0) {
+        return;
+    }
+    // Locked: its run is still going. Unlinked once we had the lock: another
+    // recover() got to it first.
+    struct stat st;
+    if (flock(journal, LOCK_EX | LOCK_NB) != 0 || fstat(journal, &st) != 0 || st.st_nlink == 0) {
+        close(journal);
+        return;
+    }
+
+    string contents;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = ::read(journal, buffer, sizeof(buffer))) > 0) {
+        contents.append(buffer, n);
+    }
+
+    struct Recorded {
+        string target;
+        string temp;
+        string backup;
+    };
+    vector<Recorded> entries;
+    bool committed = false;
+    istringstream lines(contents);
+    string line;
+    while (getline(lines, line)) {
+        if (line == "commit") {
+            committed = true;
+            continue;
+        }
+        size_t a = line.find('\t'), b = line.find('\t', a + 1);
+        if (a == string::npos || b == string::npos) continue;
+        entries.push_back(Recorded{line.substr(0, a), line.substr(a + 1, b - a - 1), line.substr(b + 1)});
+    }
+
+    vector<string> targets;
+    for (const auto& e : entries) {
+        if (!committed) {
+            // Puts the original back whether or not the rename happened: if
+            // it did not, target and backup are the same file and this is a no-op.
+            rename(e.backup.c_str(), e.target.c_str());
+        }
+        unlink(e.backup.c_str());
+        unlink(e.temp.c_str());
+        targets.push_back(e.target);
+    }
+    sync_filesystems(targets);
+    unlink(path.c_str());
+    close(journal);
+
+    Logger::getInstance().log(committed
+        ? "Cleaned up after a replace of " + to_string(entries.size()) + " files that had completed."
+        : "Rolled back an unfinished replace of " + to_string(entries.size()) + " files.");
+}
+
+bool ReplaceTransaction::recover()
+{
+    string dir = journal_dir();
+    DIR* listing = dir.empty() ? nullptr : opendir(dir.c_str());
+    if (!listing) {
+        Logger::getInstance().logError("Error: Could not read the replace journals in " + (dir.empty() ? "$HOME" : dir) + ": " + strerror(errno));
+        return false;
+    }
+    vector<string> journals;
+    while (dirent* entry = readdir(listing)) {
+        string_view name = entry->d_name;
+        if (name.size() > 8 && name.substr(name.size() - 8) == ".journal") {
+            journals.push_back(dir + "/" + entry->d_name);
+        }
+    }
+    closedir(listing);
+
+    for (const auto& path : journals) {
+        recover_journal(path);
+    }
+    return true;
+}
+
+// Reads as much of [at, at + size) as there is, short only at end of file.
+static size_t read_at(int fd, char* data, size_t size, off_t at)
+{
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, data + done, size - done, at + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) throw runtime_error(strerror(errno));
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+// Offsets of the non-overlapping matches that start in [from, end), looking
+// left to right from `from`. A match may run past `end`.
+static vector<off_t> find_matches(int fd, const string& pattern, off_t from, off_t end)
+{
+    vector<off_t> found;
+    const size_t keep = pattern.size() - 1;
+    vector<char> buffer(CHUNK_SIZE + keep);
+    off_t at = from;
+    size_t skip = 0;  // the previous chunk's last match reaches this far into this one
+
+    while (at < end) {
+        size_t starts = min<off_t>(CHUNK_SIZE, end - at);
+        size_t got = read_at(fd, buffer.data(), starts + keep, at);
+        string_view view(buffer.data(), got);
+        size_t pos = skip, match;
+        while ((match = view.find(pattern, pos)) != string_view::npos && match < starts) {
+            found.push_back(at + match);
+            pos = match + pattern.size();
+        }
+        skip = pos > starts ? pos - starts : 0;
+        at += starts;
+        if (got < starts + keep) break;
+    }
+    return found;
+}
+
+// Regions are searched independently, but with a pattern that can overlap
+// itself ("aa" in "aaa") where a region starts depends on where the last
+// match of the one before it ended. The rare region where that matters is
+// searched again from there.
+static vector<off_t> collect_matches(int fd, const string& pattern, off_t size)
+{
+    static constexpr off_t REGION_SIZE = 64 << 20;
+    size_t regions = min<size_t>(max(1u, thread::hardware_concurrency()), (size + REGION_SIZE - 1) / REGION_SIZE);
+    if (regions <= 1) {
+        return find_matches(fd, pattern, 0, size);
+    }
+
+    off_t step = (size + regions - 1) / regions;
+    vector<vector<off_t>> parts(regions);
+    vector<exception_ptr> errors(regions);
+    vector<thread> threads;
+    for (size_t r = 0; r < regions; r++) {
+        threads.emplace_back([&, r]() {
+            try {
+                parts[r] = find_matches(fd, pattern, r * step, min<off_t>((r + 1) * step, size));
+            } catch (...) {
+                errors[r] = current_exception();
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    for (auto& e : errors) {
+        if (e) rethrow_exception(e);
+    }
+
+    vector<off_t> found = move(parts[0]);
+    for (size_t r = 1; r < regions; r++) {
+        off_t taken = found.empty() ? 0 : found.back() + pattern.size();
+        if (!parts[r].empty() && parts[r].front() < taken) {
+            parts[r] = find_matches(fd, pattern, taken, min<off_t>((r + 1) * step, size));
+        }
+        found.insert(found.end(), parts[r].begin(), parts[r].end());
+    }
+    return found;
+}
+
+// Matches less than a page apart go out in one pwrite(), the page is
+// written back whole anyway. Further apart, each match is its own write
+// and the bytes between them are never touched.
+static void patch_matches(int fd, const Config& config, const vector<off_t>& matches)
+{
+    static constexpr off_t MERGE_GAP = 4096;
+    const size_t length = config.pattern.size();
+    vector<char> span;
+    for (size_t i = 0; i < matches.size(); ) {
+        size_t j = i + 1;
+        while (j < matches.size() && matches[j] - matches[j - 1] < MERGE_GAP &&
+               static_cast<size_t>(matches[j] - matches[i]) + length <= CHUNK_SIZE) {
+            j++;
+        }
+        size_t span_size = matches[j - 1] - matches[i] + length;
+        span.resize(span_size);
+        if (read_at(fd, span.data(), span_size, matches[i]) != span_size) {
+            throw runtime_error("the file got shorter");
+        }
+        for (size_t k = i; k < j; k++) {
+            char* at = span.data() + (matches[k] - matches[i]);
+            if (memcmp(at, config.pattern.data(), length) != 0) {
+                throw runtime_error("the file changed after it was searched");
+            }
+            memcpy(at, config.replacement.data(), length);
+        }
+        size_t done = 0;
+        while (done < span_size) {
+            ssize_t n = pwrite(fd, span.data() + done, span_size - done, matches[i] + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw runtime_error(strerror(errno));
+            done += n;
+        }
+        i = j;
+    }
+}
+
+optional<size_t> replace_in_place(const string& filename, const Config& config)
+{
+    int fd = open(filename.c_str(), O_RDWR | O_CLOEXEC);
+    struct stat before;
+    if (fd < 0 || fstat(fd, &before) != 0 || !S_ISREG(before.st_mode)) {
+        Logger::getInstance().logError("Warning: Could not open file for writing: " + filename);
+        if (fd >= 0) close(fd);
+        return nullopt;
+    }
+    if (config.pattern.empty() || config.replacement.size() != config.pattern.size()) {
+        close(fd);
+        return 0;
+    }
+
+    size_t replaced = 0;
+    bool writing = false;
+    try {
+        vector<off_t> matches = collect_matches(fd, config.pattern, before.st_size);
+
+        // Somebody else wrote to the file while it was being searched.
+        struct stat after;
+        if (fstat(fd, &after) != 0 || after.st_size != before.st_size ||
+            after.st_mtim.tv_sec != before.st_mtim.tv_sec || after.st_mtim.tv_nsec != before.st_mtim.tv_nsec) {
+            throw runtime_error("the file changed while it was searched");
+        }
+
+        writing = true;
+        patch_matches(fd, config, matches);
+        if (!matches.empty() && fdatasync(fd) != 0) {
+            throw runtime_error(strerror(errno));
+        }
+        replaced = matches.size();
+    } catch (const exception& e) {
+        Logger::getInstance().logError("Error: Replacing in place in " + filename + " failed: " + e.what() +
+                                       (writing ? ", some of its matches may already be replaced." : ""));
+        close(fd);
+        return nullopt;
+    }
+    close(fd);
+
+    if (replaced == 0) {
+        Logger::getInstance().log("No matches found in: " + filename);
+    } else {
+        Logger::getInstance().log("Replaced " + to_string(replaced) + " matches in place in: " + filename);
+    }
+    return replaced;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "config.h"
+#include "rules.h"
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Find-and-replace over a set of files as one transaction: either every file
+// gets its replacements or none does, even if the process dies halfway.
+//
+// Each file is rewritten into a temporary file next to it (same directory,
+// so same file system) and only ever replaced with rename(), which is atomic:
+// no file is ever missing or half written. Before the first rename, every
+// original is hard-linked to a backup name and a journal of
+// (target, temp, backup) is made durable. If a rename fails, the files
+// already renamed are restored from their backups. A later run that finds a
+// journal left by a crash does the same, or only cleans up if the journal
+// says the commit had finished.
+//
+// Journals hold absolute paths and live in one directory per user,
+// $XDG_STATE_HOME/grep-replace (or ~/.local/state/grep-replace), so a crashed
+// run is recovered by the next one wherever that is started from. A journal
+// is locked before it gets its name there, and stays locked while its
+// transaction runs.
+//
+// Durability is batched: one syncfs() per file system before the renames and
+// one after, plus two journal syncs, no matter how many files there are.
+//
+// With a RuleSet (--rules) every rule is applied in the same single pass
+// instead of config.pattern and config.replacement.
+class ReplaceTransaction {
+public:
+    explicit ReplaceTransaction(const Config& config, const RuleSet* rules = nullptr);
+    // Removes the temporary files of a transaction that was never committed.
+    ~ReplaceTransaction();
+
+    ReplaceTransaction(const ReplaceTransaction&) = delete;
+    ReplaceTransaction& operator=(const ReplaceTransaction&) = delete;
+
+    // Writes the replaced copy of filename next to it. Safe to call from
+    // several threads. Returns the number of replacements, 0 leaves the file
+    // out of the transaction.
+    size_t stage(const std::string& filename);
+
+    // Puts all staged files in place. Returns false, with every original
+    // back in place, if anything failed.
+    bool commit();
+
+    size_t replacements() const { return total; }
+    // --rules: replacements per rule, over all staged files.
+    const std::vector<size_t>& rule_hits() const { return hits; }
+
+    // Finishes or undoes every transaction a crashed run left behind.
+    // Journals of runs that are still going are left alone. Returns false if
+    // the journal directory cannot be read.
+    static bool recover();
+
+private:
+    struct Entry {
+        std::string target;
+        std::string temp;
+        std::string backup;
+    };
+
+    const Config& config;
+    const RuleSet* rules;
+    std::mutex mtx;
+    std::vector<Entry> staged;
+    size_t total = 0;
+    std::vector<size_t> hits;
+    bool failed = false;
+    bool finished = false;
+
+    void discard();
+};
+
+// --in-place, for a replacement exactly as long as the pattern: only the
+// bytes of each match are overwritten, nothing is copied or renamed.
+//
+// A first pass reads the whole file and collects the match offsets (in
+// parallel regions for a large file). The second pass reads back only the
+// bytes around those offsets, checks that the pattern is still there and
+// writes the replacement over it with pwrite(). Unlike ReplaceTransaction
+// this is not atomic: a crash during the second pass leaves some matches
+// replaced and others not, which is why it has to be asked for.
+//
+// Returns the number of replacements, or nothing if the file could not be
+// read or written or changed under us.
+std::optional<size_t> replace_in_place(const std::string& filename, const Config& config);
@@ -0,0 +1,141 @@
+#include "rules.h"
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+using namespace std;
+
+vector<Rule> load_rules(const string& path)
+{
+    ifstream file(path);
+    if (!file) {
+        throw runtime_error("Could not open rules file " + path);
+    }
+    vector<Rule> rules;
+    string line;
+    size_t number = 0;
+    while (getline(file, line)) {
+        number++;
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        size_t tab = line.find('\t');
+        if (tab == string::npos || tab == 0) {
+            throw runtime_error(path + ":" + to_string(number) + ": expected pattern<TAB>replacement");
+        }
+        rules.push_back(Rule{line.substr(0, tab), line.substr(tab + 1)});
+    }
+    if (rules.empty()) {
+        throw runtime_error("No rules in " + path);
+    }
+    return rules;
+}
+
+RuleSet::RuleSet(vector<Rule> rules_in)
+    : rules(move(rules_in))
+{
+    for (const auto& r : rules) {
+        for (unsigned char c : r.pattern) {
+            if (byte_class[c] == 0) byte_class[c] = classes++;
+        }
+        longest_pattern = max(longest_pattern, r.pattern.size());
+    }
+
+    // The trie, with 0 as "no edge yet".
+    transitions.assign(classes, 0);
+    depth.push_back(0);
+    longest_match.push_back(NO_RULE);
+    for (size_t i = 0; i < rules.size(); i++) {
+        size_t state = 0;
+        for (unsigned char c : rules[i].pattern) {
+            int32_t& next = transitions[state * classes + byte_class[c]];
+            if (next == 0) {
+                next = depth.size();
+                depth.push_back(depth[state] + 1);
+                longest_match.push_back(NO_RULE);
+                transitions.resize(transitions.size() + classes, 0);
+            }
+            state = transitions[state * classes + byte_class[c]];
+        }
+        // A pattern that is listed twice belongs to its first rule.
+        if (longest_match[state] == NO_RULE) longest_match[state] = i;
+    }
+
+    // Failure links, breadth first, folded straight into the table: a
+    // missing edge goes wherever the failure state's edge goes.
+    vector<int32_t> fail(depth.size(), 0);
+    queue<int32_t> pending;
+    for (size_t c = 0; c < classes; c++) {
+        if (transitions[c] != 0) pending.push(transitions[c]);
+    }
+    while (!pending.empty()) {
+        int32_t state = pending.front();
+        pending.pop();
+        // Nothing of its own ending here: the longest match is the failure state's.
+        if (longest_match[state] == NO_RULE) longest_match[state] = longest_match[fail[state]];
+        for (size_t c = 0; c < classes; c++) {
+            int32_t& next = transitions[state * classes + c];
+            int32_t via_fail = transitions[fail[state] * classes + c];
+            if (next != 0) {
+                fail[next] = via_fail;
+                pending.push(next);
+            } else {
+                next = via_fail;
+            }
+        }
+    }
+}
+
+// Matches are found where they end. A match is only certain to be the
+// leftmost-longest once no match still in progress can start at or before
+// it, which the depth of the current state tells: nothing alive started
+// before i - depth. Once it is replaced, scanning starts over from the root
+// right behind it, which re-reads at most the longest pattern's worth.
+size_t RuleSet::rewrite(const char* text, size_t size, bool at_end, string& out, vector<size_t>& hits) const
+{
+    size_t pos = 0;     // text[0, pos) is in out already
+    size_t i = 0;
+    int32_t state = 0;
+    int32_t best = NO_RULE;
+    size_t best_start = 0;
+
+    auto replace_best = [&]() {
+        const Rule& r = rules[best];
+        out.append(text + pos, best_start - pos).append(r.replacement);
+        hits[best]++;
+        pos = i = best_start + r.pattern.size();
+        state = 0;
+        best = NO_RULE;
+    };
+
+    while (true) {
+        if (i == size) {
+            if (best != NO_RULE && at_end) {
+                replace_best();
+                continue;
+            }
+            break;
+        }
+        state = transitions[state * classes + byte_class[static_cast<unsigned char>(text[i])]];
+        i++;
+
+        int32_t found = longest_match[state];
+        if (found != NO_RULE) {
+            size_t start = i - rules[found].pattern.size();
+            // Ends later than the current best, so starting at the same byte means longer.
+            if (best == NO_RULE || start <= best_start) {
+                best = found;
+                best_start = start;
+            }
+        }
+        if (best != NO_RULE && i - depth[state] > best_start) {
+            replace_best();
+        }
+    }
+
+    size_t keep_from = size;
+    if (!at_end) {
+        keep_from = size - depth[state];
+        if (best != NO_RULE) keep_from = min(keep_from, best_start);
+    }
+    out.append(text + pos, keep_from - pos);
+    return keep_from;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Rule {
+    std::string pattern;
+    std::string replacement;
+};
+
+// Reads a --rules file: one "pattern<TAB>replacement" per line. Empty lines
+// and lines starting with # are skipped. Throws runtime_error naming the
+// line that is wrong.
+std::vector<Rule> load_rules(const std::string& path);
+
+// All rules of a --rules file compiled into one Aho-Corasick automaton, so a
+// file is rewritten in a single pass no matter how many rules there are.
+//
+// Matching is leftmost-longest: of all matches, the one that starts first
+// wins, and of those starting at the same byte the longest. Rewriting then
+// continues right after it, so replacements never overlap or feed into each
+// other, just as if every rule had been applied at once.
+class RuleSet {
+public:
+    explicit RuleSet(std::vector<Rule> rules);
+
+    size_t size() const { return rules.size(); }
+    const Rule& rule(size_t i) const { return rules[i]; }
+    // Length of the longest pattern, the most rewrite() leaves unconsumed.
+    size_t longest() const { return longest_pattern; }
+
+    // Appends the rewritten text[0, returned) to out and counts each
+    // replacement in hits[rule]. Unless at_end, the tail that could still
+    // be the start of a match is not consumed and has to be passed in again
+    // in front of the next bytes.
+    size_t rewrite(const char* text, size_t size, bool at_end, std::string& out, std::vector<size_t>& hits) const;
+
+private:
+    static constexpr int32_t NO_RULE = -1;
+
+    std::vector<Rule> rules;
+    size_t longest_pattern = 0;
+
+    // Bytes that occur in no pattern all share one class, which keeps the
+    // transition table small enough to stay in cache.
+    std::array<uint8_t, 256> byte_class{};
+    size_t classes = 1;
+    // transitions[state * classes + class], complete: no failure links to follow.
+    std::vector<int32_t> transitions;
+    // Per state: its depth, which is how far back a match still in progress
+    // can have started, and the rule of the longest pattern ending here.
+    std::vector<uint32_t> depth;
+    std::vector<int32_t> longest_match;
+};
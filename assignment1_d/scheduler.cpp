@@ -0,0 +1,113 @@
+#include "scheduler.h"
+#include "file_processor.h"
+#include "logger.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+using namespace std;
+
+// "abab" can overlap itself ("ababab" holds it twice, or once and a
+// half), which makes the count depend on where a search starts.
+static bool can_overlap(const string& pattern)
+{
+    for (size_t shift = 1; shift < pattern.size(); shift++) {
+        if (pattern.compare(0, pattern.size() - shift, pattern, shift, string::npos) == 0) return true;
+    }
+    return false;
+}
+
+// Counting the occurrences and nothing else.
+static bool may_split(const Config& config)
+{
+    return !config.print_lines && !config.invert_match && !config.files_with_matches && !config.ignore_case &&
+           config.max_count == 0 && !config.replace_mode && !config.word_count && !config.follow &&
+           !config.pattern.empty() && !can_overlap(config.pattern);
+}
+
+// What execute_search would search as plain text: not compressed, and not
+// binary by its rule, a NUL byte in the first block.
+static bool plain_text(const string& filename, const Config& config)
+{
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    vector<unsigned char> head(2 << 20);
+    ssize_t got = pread(fd, head.data(), head.size(), 0);
+    close(fd);
+    if (got < 4) {
+        return false;
+    }
+    bool gzip = head[0] == 0x1f && head[1] == 0x8b;
+    bool zstd = head[0] == 0x28 && head[1] == 0xb5 && head[2] == 0x2f && head[3] == 0xfd;
+    bool binary = !config.binary_as_text && memchr(head.data(), '\0', got) != nullptr;
+    return !gzip && !zstd && !binary;
+}
+
+WorkPlan::WorkPlan(const Config& config)
+    : splits(config.files.size())
+{
+    bool split = may_split(config);
+    for (size_t i = 0; i < config.files.size(); i++) {
+        const string& filename = config.files[i];
+        // Standard input has no size, and it may be somebody typing: first.
+        uint64_t size = numeric_limits<uint64_t>::max();
+        struct stat st;
+        bool regular = false;
+        if (filename != "-" && stat(filename.c_str(), &st) == 0) {
+            size = st.st_size;
+            regular = S_ISREG(st.st_mode);
+        }
+
+        if (split && regular && size >= 2 * PIECE_SIZE && plain_text(filename, config)) {
+            size_t pieces = (size + PIECE_SIZE - 1) / PIECE_SIZE;
+            splits[i] = make_unique<Split>();
+            splits[i]->left = pieces;
+            split_count++;
+            for (size_t p = 0; p < pieces; p++) {
+                uint64_t begin = p * PIECE_SIZE;
+                uint64_t end = min(size, begin + PIECE_SIZE);
+                work.push_back(WorkItem{i, true, begin, end, end - begin});
+            }
+        } else {
+            work.push_back(WorkItem{i, false, 0, 0, size});
+        }
+    }
+    // Stable, so that files of the same size keep the command line order.
+    stable_sort(work.begin(), work.end(), [](const WorkItem& a, const WorkItem& b) { return a.cost > b.cost; });
+}
+
+void WorkPlan::search_piece(const WorkItem& item, const Config& config, Shared& data)
+{
+    Split& split = *splits[item.file];
+    const string& filename = config.files[item.file];
+    call_once(split.started, [&] { split.start = chrono::steady_clock::now(); });
+    try {
+        size_t found = count_range(filename, config.pattern, item.begin, item.end);
+        split.count += found;
+        std::unique_lock<std::shared_mutex> data_lock(data.data_mtx);
+        data.total_occ += found;
+    } catch (const exception& e) {
+        Logger::getInstance().logError("Error reading " + filename + ": " + e.what());
+        split.failed = true;
+        data.failed = true;
+    }
+
+    if (split.left.fetch_sub(1) != 1) {
+        return;
+    }
+    // The last piece of the file.
+    auto duration = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - split.start).count();
+    data.results.append(FileResult{filename, split.count, duration, false});
+    if (split.failed || config.listing_mode()) {
+        return;
+    }
+    Logger::getInstance().log("Found " + to_string(split.count) + " occurrences in " + filename);
+    Logger::getInstance().log("Processed " + filename + " in " + to_string(duration) + " ms");
+}
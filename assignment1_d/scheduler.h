@@ -0,0 +1,57 @@
+#pragma once
+
+#include "config.h"
+#include "thread_safe.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// One job for the worker pool: a whole file, or a byte range of a large one.
+struct WorkItem {
+    size_t file = 0;        // index into config.files
+    bool piece = false;     // [begin, end) of the file rather than all of it
+    uint64_t begin = 0;
+    uint64_t end = 0;
+    uint64_t cost = 0;      // bytes, what the order is decided by
+};
+
+// The order in which files are handed to the workers. Every file is stat()ed
+// up front and the work is sorted longest first (LPT), so a huge file is
+// started early instead of being picked up last and running alone while
+// every other worker is idle. That bounds the makespan at 4/3 of the best
+// possible order.
+//
+// When only counting, a file of at least two PIECE_SIZE pieces is also cut
+// into pieces that are counted independently, so no single file is a job
+// much longer than the others. This needs every occurrence of the pattern
+// to count regardless of where a search starts, which holds when the
+// pattern cannot overlap itself, and plain uncompressed text.
+class WorkPlan {
+public:
+    static constexpr uint64_t PIECE_SIZE = 32 << 20;
+
+    explicit WorkPlan(const Config& config);
+
+    const std::vector<WorkItem>& items() const { return work; }
+    size_t split_files() const { return split_count; }
+
+    // Counts one piece. The last piece of a file to finish records the
+    // file's result and log lines the way execute_search does.
+    void search_piece(const WorkItem& item, const Config& config, Shared& data);
+
+private:
+    struct Split {
+        std::atomic<size_t> count{0};
+        std::atomic<size_t> left{0};
+        std::atomic<bool> failed{false};
+        std::once_flag started;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    std::vector<WorkItem> work;
+    std::vector<std::unique_ptr<Split>> splits;  // per file, null unless it was split
+    size_t split_count = 0;
+};
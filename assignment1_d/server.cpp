@@ -0,0 +1,346 @@
+#include "server.h"
+#include "arguments.h"
+#include "file_processor.h"
+#include "logger.h"
+#include "thread_safe.h"
+#include "word_counter.h"
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+static constexpr size_t MAX_REQUEST = 1 << 16;
+// For the whole request line, so that a client which connects and then
+// sends nothing, or a byte at a time, cannot keep an acceptor forever.
+static constexpr chrono::milliseconds REQUEST_TIMEOUT{5000};
+static constexpr size_t MAX_CACHED_RESULTS = 1 << 16;
+
+// Started once with the server. Files of all requests go through the same
+// workers, so a request costs a queue push per file instead of a thread. The
+// queue is lock-free, and a request's files go in with as few operations on
+// it as fit, so workers taking files do not wait behind a request that is
+// still handing its files over.
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t count)
+        : tasks(QUEUE_CAPACITY)
+    {
+        for (size_t i = 0; i < count; i++) {
+            workers.emplace_back([this]() { run(); });
+        }
+    }
+
+    // An empty task per worker, behind everything already queued.
+    ~WorkerPool()
+    {
+        vector<function<void()>> stop(workers.size());
+        submit(stop);
+        for (auto& t : workers) {
+            t.join();
+        }
+    }
+
+    // Queues the tasks in order, moving them out of `batch`.
+    void submit(vector<function<void()>>& batch)
+    {
+        size_t done = 0;
+        while (done < batch.size()) {
+            size_t pushed = tasks.try_push_batch(batch.data() + done, batch.size() - done);
+            if (pushed == 0) {
+                // Full, let the workers catch up.
+                this_thread::yield();
+                continue;
+            }
+            pending.release(pushed);
+            done += pushed;
+        }
+    }
+
+private:
+    static constexpr size_t QUEUE_CAPACITY = 4096;
+
+    MPMCQueue<function<void()>> tasks;
+    // Counts the tasks in the queue, idle workers sleep on it.
+    counting_semaphore<> pending{0};
+    vector<thread> workers;
+
+    void run()
+    {
+        while (true) {
+            pending.acquire();
+            function<void()> task;
+            while (!tasks.try_pop(task)) {
+                // Another worker may be racing us for the same cell.
+                this_thread::yield();
+            }
+            if (!task) {
+                return;
+            }
+            task();
+        }
+    }
+};
+
+// Match counts of files that have not changed since they were last searched
+// with the same pattern and flags. Unchanged means same device, inode, size
+// and modification time, which is what monitoring re-runs mostly hit.
+class ResultCache {
+public:
+    struct Entry {
+        size_t count;
+        bool binary;
+    };
+
+    // Only plain counting is cached: printed lines have to be produced again
+    // anyway, and -m results depend on what the other files found.
+    static bool usable(const Config& config)
+    {
+        return !config.print_lines && !config.word_count && config.max_count == 0;
+    }
+
+    static optional<string> key_for(const string& filename, const Config& config)
+    {
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            return nullopt;
+        }
+        string key = to_string(st.st_dev) + ':' + to_string(st.st_ino) + ':' + to_string(st.st_size) + ':' +
+                     to_string(st.st_mtim.tv_sec) + '.' + to_string(st.st_mtim.tv_nsec) + ':';
+        key += config.ignore_case ? 'i' : '-';
+        key += config.invert_match ? 'v' : '-';
+        key += config.files_with_matches ? 'l' : '-';
+        key += config.skip_binary ? 'I' : '-';
+        key += config.binary_as_text ? 'a' : '-';
+        key += ':';
+        key += config.pattern;
+        return key;
+    }
+
+    optional<Entry> find(const string& key)
+    {
+        shared_lock<shared_mutex> lock(mtx);
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            return nullopt;
+        }
+        return it->second;
+    }
+
+    void store(const string& key, Entry entry)
+    {
+        unique_lock<shared_mutex> lock(mtx);
+        // Keys of modified files are never hit again, starting over now and
+        // then is the simplest way to get rid of them.
+        if (entries.size() >= MAX_CACHED_RESULTS) {
+            entries.clear();
+        }
+        entries[key] = entry;
+    }
+
+private:
+    shared_mutex mtx;
+    unordered_map<string, Entry> entries;
+};
+
+static void search_file(size_t index, const Config& config, Shared& data, vector<WordTable>& tables, ResultCache& cache)
+{
+    const string& filename = config.files[index];
+    if (config.word_count) {
+        execute_wordcount(filename, config, tables[index], data);
+        return;
+    }
+
+    optional<string> key;
+    if (ResultCache::usable(config)) {
+        key = ResultCache::key_for(filename, config);
+    }
+    if (key) {
+        if (auto hit = cache.find(*key)) {
+            {
+                unique_lock<shared_mutex> lock(data.data_mtx);
+                data.total_occ += hit->count;
+            }
+            data.results.append(FileResult{filename, hit->count, 0, hit->binary});
+            return;
+        }
+    }
+
+    auto result = execute_search(filename, config, data);
+    if (key && result) {
+        cache.store(*key, ResultCache::Entry{result->count, result->binary});
+    }
+}
+
+static vector<string> read_request(int fd)
+{
+    string line;
+    char buffer[4096];
+    const auto deadline = chrono::steady_clock::now() + REQUEST_TIMEOUT;
+    while (line.find('\n') == string::npos && line.size() < MAX_REQUEST) {
+        auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+        pollfd p{fd, POLLIN, 0};
+        int ready = left.count() > 0 ? poll(&p, 1, static_cast<int>(left.count())) : 0;
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready == 0) throw runtime_error("timed out waiting for the request");
+        if (ready < 0) break;
+        ssize_t n = ::read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        line.append(buffer, n);
+    }
+    line = line.substr(0, line.find('\n'));
+
+    vector<string> args;
+    size_t start = 0;
+    while (start <= line.size() && !line.empty()) {
+        size_t tab = line.find('\t', start);
+        if (tab == string::npos) tab = line.size();
+        args.push_back(line.substr(start, tab - start));
+        start = tab + 1;
+    }
+    return args;
+}
+
+static void handle_client(int fd, WorkerPool& pool, ResultCache& cache)
+{
+    Config config;
+    Shared data;
+    data.out_fd = fd;
+
+    try {
+        if (!parse_arguments(read_request(fd), config)) {
+            throw runtime_error("help is only available on the command line");
+        }
+        if (!config.serve_socket.empty()) throw runtime_error("--serve is not a request");
+        if (config.replace_mode) throw runtime_error("replacing is not supported over the socket");
+        if (config.follow) throw runtime_error("--follow is not supported over the socket");
+        if (find(config.files.begin(), config.files.end(), "-") != config.files.end()) {
+            throw runtime_error("the server has no standard input to read");
+        }
+    } catch (const exception& e) {
+        data.emit("error: " + string(e.what()) + "\n");
+        return;
+    }
+
+    if (!config.listing_mode()) {
+        config.count_only = true;
+    }
+
+    // What the workers print is written to the socket by this thread. A
+    // client that reads slowly then holds up the workers every request
+    // shares only once a whole queue of its output is waiting, not on
+    // every write the socket buffer cannot take straight away.
+    OutputQueue output;
+    data.out_queue = &output;
+
+    vector<WordTable> tables(config.word_count ? config.files.size() : 0);
+    vector<function<void()>> batch;
+    for (size_t i = 0; i < config.files.size(); i++) {
+        batch.push_back([&, i]() {
+            if (!data.stop.stop_requested()) {
+                search_file(i, config, data, tables, cache);
+            }
+            output.finish();
+        });
+    }
+    pool.submit(batch);
+
+    vector<string> blocks(output.blocks.capacity());
+    size_t finished = 0;
+    while (finished < config.files.size()) {
+        output.ready.acquire();
+        // The release comes after its push, so there is at least one block.
+        size_t n;
+        while ((n = output.blocks.try_pop_batch(blocks.data(), blocks.size())) == 0) {
+            this_thread::yield();
+        }
+        // Each block taken has its own release, the first one's was just
+        // acquired. The others are made or on their way.
+        for (size_t i = 1; i < n; i++) {
+            output.ready.acquire();
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (blocks[i].empty()) finished++;
+            else data.write_out(blocks[i]);
+        }
+    }
+    data.out_queue = nullptr;
+
+    if (config.word_count) {
+        print_word_counts(tables, config, max(1u, thread::hardware_concurrency()), data);
+    } else {
+        print_file_stats(config, data);
+    }
+}
+
+int run_server(const string& socket_path)
+{
+    // A client that hangs up early must not take the server down with it.
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un addr{};
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        Logger::getInstance().logError("Socket path is too long: " + socket_path);
+        return 1;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        Logger::getInstance().logError("Could not create socket: " + string(strerror(errno)));
+        return 1;
+    }
+    // A socket file left behind by an earlier run would make bind fail.
+    unlink(socket_path.c_str());
+    if (bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listener, 128) != 0) {
+        Logger::getInstance().logError("Could not listen on " + socket_path + ": " + strerror(errno));
+        close(listener);
+        return 1;
+    }
+
+    unsigned threads = max(4u, thread::hardware_concurrency());
+    WorkerPool pool(threads);
+    ResultCache cache;
+    Logger::getInstance().log("Listening on " + socket_path + " with " + to_string(threads) + " workers");
+
+    // Several connections are served at once, each acceptor blocks in its
+    // request until the pool has finished all of its files.
+    vector<thread> acceptors;
+    for (unsigned i = 0; i < threads; i++) {
+        acceptors.emplace_back([&]() {
+            while (true) {
+                int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) continue;
+                    Logger::getInstance().logError("accept failed: " + string(strerror(errno)));
+                    return;
+                }
+                handle_client(fd, pool, cache);
+                close(fd);
+            }
+        });
+    }
+    for (auto& t : acceptors) {
+        t.join();
+    }
+
+    close(listener);
+    return 1;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <string>
+
+// --serve: a long-running process that answers search requests on a Unix
+// domain socket, so that frequent small searches skip process start-up, thread
+// creation and re-reading files that have not changed.
+//
+// A client connects, sends one line holding the usual command line arguments
+// separated by tabs (e.g. "-c\thello\tapp.log") and reads the answer until the
+// server closes the connection. Lines printed with -p stream back as they are
+// found. Requests without -p, -c, -l, --top or --wordcount are answered as if
+// -c was given, there is no progress chatter on a socket. A request line has
+// to arrive within a few seconds of connecting. Anything that cannot be
+// answered this way (-r, --follow, standard input) gets an "error: ..." line.
+//
+// Runs until killed. Returns non-zero if the socket could not be set up.
+int run_server(const std::string& socket_path);
@@ -1,9 +1,93 @@
 #pragma once
 #include <shared_mutex>
 #include <iostream>
+#include <string>
+#include <atomic>
+#include <stop_token>
+#include <string_view>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+#include <unistd.h>
+#include "logger.h"
+#include "../common/append_log.h"
+#include "../common/mpmc_queue.h"
+
+struct FileResult {
+  std::string filename;
+  size_t count = 0;
+  long long duration_ms = 0;
+  // Binary files stop at the first match, so count is only 0 or 1 for them.
+  bool binary = false;
+};
+
+// Blocks of output on their way from the workers to the one thread that
+// writes them. A worker only waits here when the writer is a whole queue
+// behind. A block is up to a round of the search kernel, about a megabyte.
+//
+// Every item comes with exactly one release of `ready`, and the writer
+// acquires once per item it takes. An empty block is a producer's last word
+// (see finish()): once the writer has taken as many of those as there are
+// producers, every release has been acquired and no producer touches the
+// queue again, so the writer may destroy it.
+struct OutputQueue {
+  MPMCQueue<std::string> blocks{32};
+  std::counting_semaphore<> ready{0};
+
+  void push(std::string_view text) {
+    if (!text.empty()) {
+      put(std::string(text));
+    }
+  }
+
+  void finish() { put(std::string()); }
+
+private:
+  void put(std::string block) {
+    while (!blocks.try_push(std::move(block))) {
+      std::this_thread::yield();
+    }
+    ready.release();
+  }
+};
 
 struct Shared {
   std::shared_mutex data_mtx;
   size_t total_occ = 0;
   bool complete = false;
-};
\ No newline at end of file
+  // One entry per searched file, appended by the worker without taking data_mtx.
+  AppendLog<FileResult> results;
+  // Cooperative cancellation for -m/--first. Workers poll it between chunks.
+  std::stop_source stop;
+  std::atomic<size_t> limit_count{0};
+  // Some input could not be read in full, the run has to exit non-zero.
+  std::atomic<bool> failed{false};
+
+  // Results (matching lines, listings) go to stdout, or with --serve to the
+  // socket of the client that asked for them. While out_queue is set they
+  // are queued for another thread to write_out() instead.
+  int out_fd = -1;
+  std::mutex out_mtx;
+  OutputQueue* out_queue = nullptr;
+
+  void emit(std::string_view text) {
+    if (out_queue) {
+      out_queue->push(text);
+      return;
+    }
+    write_out(text);
+  }
+
+  void write_out(std::string_view text) {
+    if (out_fd < 0) {
+      Logger::getInstance().write(text);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(out_mtx);
+    while (!text.empty()) {
+      ssize_t n = ::write(out_fd, text.data(), text.size());
+      if (n <= 0) return;  // the client went away, nothing left to tell it
+      text.remove_prefix(n);
+    }
+  }
+};
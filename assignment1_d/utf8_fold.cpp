@@ -0,0 +1,236 @@
+#include "utf8_fold.h"
+#include <algorithm>
+#include <unordered_map>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+// Invalid bytes decode to a value past the last code point, so they are
+// never equal to a real character, only to the same invalid byte.
+static constexpr char32_t INVALID_BASE = 0x110000;
+
+char32_t fold_case(char32_t c)
+{
+    if (c < 0x80) {
+        return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+    }
+    if (c < 0x100) {
+        if (c >= 0xC0 && c <= 0xDE && c != 0xD7) return c + 32;
+        if (c == 0xB5) return 0x3BC;  // micro sign
+        return c;
+    }
+    if (c < 0x180) {
+        // Dotted and dotless i and the kra have no simple folding.
+        if (c == 0x130 || c == 0x131 || c == 0x138 || c == 0x149) return c;
+        if (c == 0x178) return 0xFF;
+        if (c == 0x17F) return 's';
+        if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E)) return (c & 1) ? c + 1 : c;
+        return (c & 1) ? c : c + 1;
+    }
+    if (c < 0x250) {
+        // Latin Extended-B: runs of upper/lower pairs, and one by one the
+        // letters whose other case is in IPA Extensions or elsewhere and the
+        // DŽ/Dž/dž style triples.
+        if (c >= 0x1CD && c <= 0x1DC) return (c & 1) ? c + 1 : c;
+        if ((c >= 0x1DE && c <= 0x1EF) || (c >= 0x1F8 && c <= 0x21F) || (c >= 0x222 && c <= 0x233) ||
+            (c >= 0x246 && c <= 0x24F)) {
+            return (c & 1) ? c : c + 1;
+        }
+        static constexpr char32_t IRREGULAR[][2] = {
+            {0x181, 0x253}, {0x182, 0x183}, {0x184, 0x185}, {0x186, 0x254}, {0x187, 0x188}, {0x189, 0x256},
+            {0x18A, 0x257}, {0x18B, 0x18C}, {0x18E, 0x1DD}, {0x18F, 0x259}, {0x190, 0x25B}, {0x191, 0x192},
+            {0x193, 0x260}, {0x194, 0x263}, {0x196, 0x269}, {0x197, 0x268}, {0x198, 0x199}, {0x19C, 0x26F},
+            {0x19D, 0x272}, {0x19F, 0x275}, {0x1A0, 0x1A1}, {0x1A2, 0x1A3}, {0x1A4, 0x1A5}, {0x1A6, 0x280},
+            {0x1A7, 0x1A8}, {0x1A9, 0x283}, {0x1AC, 0x1AD}, {0x1AE, 0x288}, {0x1AF, 0x1B0}, {0x1B1, 0x28A},
+            {0x1B2, 0x28B}, {0x1B3, 0x1B4}, {0x1B5, 0x1B6}, {0x1B7, 0x292}, {0x1B8, 0x1B9}, {0x1BC, 0x1BD},
+            {0x1C4, 0x1C6}, {0x1C5, 0x1C6}, {0x1C7, 0x1C9}, {0x1C8, 0x1C9}, {0x1CA, 0x1CC}, {0x1CB, 0x1CC},
+            {0x1F1, 0x1F3}, {0x1F2, 0x1F3}, {0x1F4, 0x1F5}, {0x1F6, 0x195}, {0x1F7, 0x1BF}, {0x220, 0x19E},
+            {0x23A, 0x2C65}, {0x23B, 0x23C}, {0x23D, 0x19A}, {0x23E, 0x2C66}, {0x241, 0x242}, {0x243, 0x180},
+            {0x244, 0x289}, {0x245, 0x28C},
+        };
+        auto it = lower_bound(begin(IRREGULAR), end(IRREGULAR), c,
+                              [](const char32_t (&pair)[2], char32_t key) { return pair[0] < key; });
+        return it != end(IRREGULAR) && (*it)[0] == c ? (*it)[1] : c;
+    }
+    if (c >= 0x370 && c < 0x400) {
+        if (c == 0x386) return 0x3AC;
+        if (c >= 0x388 && c <= 0x38A) return c + 37;
+        if (c == 0x38C) return 0x3CC;
+        if (c == 0x38E || c == 0x38F) return c + 63;
+        if (c >= 0x391 && c <= 0x3AB && c != 0x3A2) return c + 32;
+        if (c == 0x3C2) return 0x3C3;  // final sigma
+        return c;
+    }
+    if (c >= 0x400 && c < 0x530) {
+        if (c < 0x410) return c + 80;
+        if (c < 0x430) return c + 32;
+        if ((c >= 0x460 && c <= 0x481) || (c >= 0x48A && c <= 0x4BF) || (c >= 0x4D0 && c <= 0x52F)) {
+            return (c & 1) ? c : c + 1;
+        }
+        if (c == 0x4C0) return 0x4CF;
+        if (c >= 0x4C1 && c <= 0x4CE) return (c & 1) ? c + 1 : c;
+        return c;
+    }
+    if (c >= 0x531 && c <= 0x556) return c + 48;
+    if (c >= 0x1E00 && c <= 0x1EFF) {
+        if (c == 0x1E9E) return 0xDF;  // capital sharp s
+        if (c >= 0x1E96 && c <= 0x1E9F) return c;
+        return (c & 1) ? c : c + 1;
+    }
+    if (c == 0x2126) return 0x3C9;  // ohm sign
+    if (c == 0x212A) return 'k';    // Kelvin sign
+    if (c == 0x212B) return 0xE5;   // angstrom sign
+    if (c >= 0xFF21 && c <= 0xFF3A) return c + 32;
+    return c;
+}
+
+// Decodes the character at text[pos], sets its length in bytes.
+static char32_t decode(const unsigned char* text, size_t size, size_t pos, size_t& length)
+{
+    unsigned char b = text[pos];
+    length = 1;
+    if (b < 0x80) return b;
+
+    size_t need;
+    char32_t c;
+    if (b >= 0xC2 && b <= 0xDF) { need = 1; c = b & 0x1F; }
+    else if (b >= 0xE0 && b <= 0xEF) { need = 2; c = b & 0x0F; }
+    else if (b >= 0xF0 && b <= 0xF4) { need = 3; c = b & 0x07; }
+    else return INVALID_BASE + b;
+
+    if (pos + need >= size) {
+        return INVALID_BASE + b;  // cut off by the end of the text
+    }
+    for (size_t i = 1; i <= need; i++) {
+        unsigned char cont = text[pos + i];
+        if ((cont & 0xC0) != 0x80) return INVALID_BASE + b;
+        c = (c << 6) | (cont & 0x3F);
+    }
+    // Overlong forms and surrogates are not characters either.
+    if ((need == 2 && (c < 0x800 || (c >= 0xD800 && c <= 0xDFFF))) || (need == 3 && (c < 0x10000 || c > 0x10FFFF))) {
+        return INVALID_BASE + b;
+    }
+    length = need + 1;
+    return c;
+}
+
+static size_t encode(char32_t c, unsigned char* out)
+{
+    if (c < 0x80) { out[0] = c; return 1; }
+    if (c < 0x800) { out[0] = 0xC0 | (c >> 6); out[1] = 0x80 | (c & 0x3F); return 2; }
+    if (c < 0x10000) { out[0] = 0xE0 | (c >> 12); out[1] = 0x80 | ((c >> 6) & 0x3F); out[2] = 0x80 | (c & 0x3F); return 3; }
+    out[0] = 0xF0 | (c >> 18); out[1] = 0x80 | ((c >> 12) & 0x3F); out[2] = 0x80 | ((c >> 6) & 0x3F); out[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
+
+// For every folded character, the other characters that fold to it. Built
+// once, fold_case only ever changes characters in the BMP.
+static const unordered_map<char32_t, vector<char32_t>>& fold_variants()
+{
+    static const auto variants = []() {
+        unordered_map<char32_t, vector<char32_t>> v;
+        for (char32_t c = 0; c < 0x10000; c++) {
+            char32_t f = fold_case(c);
+            if (f != c) v[f].push_back(c);
+        }
+        return v;
+    }();
+    return variants;
+}
+
+FoldedPattern::FoldedPattern(string_view pattern)
+{
+    const auto* bytes = reinterpret_cast<const unsigned char*>(pattern.data());
+    const auto& variants = fold_variants();
+    unsigned char utf8[4];
+
+    for (size_t pos = 0; pos < pattern.size(); ) {
+        size_t length;
+        char32_t c = decode(bytes, pattern.size(), pos, length);
+        pos += length;
+        char32_t f = c >= INVALID_BASE ? c : fold_case(c);
+
+        vector<char32_t> forms = {f};
+        if (auto it = variants.find(f); it != variants.end()) {
+            forms.insert(forms.end(), it->second.begin(), it->second.end());
+        }
+
+        size_t longest = 0;
+        for (char32_t form : forms) {
+            size_t n = form >= INVALID_BASE ? 1 : encode(form, utf8);
+            if (form >= INVALID_BASE) utf8[0] = static_cast<unsigned char>(form - INVALID_BASE);
+            longest = max(longest, n);
+            if (folded.empty() && !starts[utf8[0]]) {
+                starts[utf8[0]] = true;
+                start_bytes.push_back(utf8[0]);
+            }
+        }
+        max_bytes += longest;
+        folded.push_back(f);
+    }
+}
+
+size_t FoldedPattern::next_candidate(const char* text, size_t size, size_t pos) const
+{
+#ifdef __SSE2__
+    // Nearly always 2 or 3 bytes ('h' and 'H', say), compared all at once.
+    if (start_bytes.size() <= 4) {
+        __m128i needles[4];
+        size_t n = start_bytes.size();
+        for (size_t i = 0; i < 4; i++) {
+            needles[i] = _mm_set1_epi8(static_cast<char>(start_bytes[min(i, n - 1)]));
+        }
+        while (pos + 16 <= size) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + pos));
+            __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, needles[0]), _mm_cmpeq_epi8(x, needles[1])),
+                                       _mm_or_si128(_mm_cmpeq_epi8(x, needles[2]), _mm_cmpeq_epi8(x, needles[3])));
+            unsigned mask = _mm_movemask_epi8(hit);
+            if (mask) return pos + __builtin_ctz(mask);
+            pos += 16;
+        }
+    }
+#endif
+    while (pos < size && !starts[static_cast<unsigned char>(text[pos])]) {
+        pos++;
+    }
+    return pos < size ? pos : npos;
+}
+
+// Length in bytes of the match at pos, 0 if there is none.
+size_t FoldedPattern::match_at(const char* text, size_t size, size_t pos) const
+{
+    const auto* bytes = reinterpret_cast<const unsigned char*>(text);
+    size_t i = pos;
+    for (char32_t want : folded) {
+        if (i >= size) return 0;
+        unsigned char b = bytes[i];
+        if (b < 0x80) {
+            // ASCII: no decoding, and the only case mapping is A-Z.
+            char32_t c = (b >= 'A' && b <= 'Z') ? b + 32 : b;
+            if (c != want) return 0;
+            i++;
+            continue;
+        }
+        size_t length;
+        char32_t c = decode(bytes, size, i, length);
+        if ((c >= INVALID_BASE ? c : fold_case(c)) != want) return 0;
+        i += length;
+    }
+    return i - pos;
+}
+
+size_t FoldedPattern::find(const char* text, size_t size, size_t pos, size_t& length) const
+{
+    if (folded.empty()) {
+        length = 0;
+        return pos <= size ? pos : npos;
+    }
+    while ((pos = next_candidate(text, size, pos)) != npos) {
+        if ((length = match_at(text, size, pos)) > 0) {
+            return pos;
+        }
+        pos++;
+    }
+    return npos;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Simple (one code point to one code point) Unicode case folding for Latin
+// (Latin-1, Extended-A and -B, Extended Additional), Greek, Cyrillic,
+// Armenian and fullwidth Latin, ASCII included. Code points outside those
+// blocks fold to themselves.
+char32_t fold_case(char32_t c);
+
+// Case-insensitive search for one pattern in raw UTF-8, without transcoding
+// or lowering the text first. Candidates come from a scan for the few bytes
+// that can start the first character in any case (16 bytes at a time with
+// SSE2). Only at a candidate is the text decoded, and only as far as the
+// comparison gets, so mostly-ASCII text costs little more than a literal search.
+//
+// Matches can be longer or shorter in bytes than the pattern: "k" matches
+// the Kelvin sign (3 bytes), "s" matches the long s (2 bytes). Bytes that are
+// not valid UTF-8 only ever match themselves.
+class FoldedPattern {
+public:
+    explicit FoldedPattern(std::string_view pattern);
+
+    // Offset of the first match starting in text[pos, size), or npos. The
+    // length of the match in bytes goes to `length`.
+    size_t find(const char* text, size_t size, size_t pos, size_t& length) const;
+
+    // The most bytes a single match can span, for the overlap kept between chunks.
+    size_t max_match_bytes() const { return max_bytes; }
+
+    bool empty() const { return folded.empty(); }
+
+    static constexpr size_t npos = std::string_view::npos;
+
+private:
+    std::vector<char32_t> folded;
+    size_t max_bytes = 0;
+    // Every byte that can start the first character, in any of its cases.
+    bool starts[256] = {};
+    std::vector<unsigned char> start_bytes;
+
+    size_t next_candidate(const char* text, size_t size, size_t pos) const;
+    size_t match_at(const char* text, size_t size, size_t pos) const;
+};
@@ -0,0 +1,256 @@
+#include "word_counter.h"
+#include "logger.h"
+#include "input_source.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <shared_mutex>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+static constexpr size_t CHUNK_SIZE = 1 << 20;
+static constexpr size_t ARENA_BLOCK = 1 << 16;
+
+static inline bool is_word_byte(unsigned char c)
+{
+    unsigned char lower = c | 0x20;
+    return (lower >= 'a' && lower <= 'z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+#ifdef __SSE2__
+// One bit per byte of the 16 at p, set where the byte belongs to a word.
+static inline unsigned word_mask(const char* p)
+{
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    // Signed compares, so bytes >= 0x80 never count as letters or digits here.
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                   _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+    unsigned mask = _mm_movemask_epi8(_mm_or_si128(letter, digit));
+    return mask | static_cast<unsigned>(_mm_movemask_epi8(x));
+}
+#endif
+
+// First position at or after i where is_word_byte(text[pos]) == want.
+static size_t scan(const char* text, size_t i, size_t size, bool want)
+{
+#ifdef __SSE2__
+    while (i + 16 <= size) {
+        unsigned mask = word_mask(text + i);
+        if (!want) mask = ~mask & 0xFFFF;
+        if (mask) return i + __builtin_ctz(mask);
+        i += 16;
+    }
+#endif
+    while (i < size && is_word_byte(text[i]) != want) {
+        i++;
+    }
+    return i;
+}
+
+uint64_t WordTable::hash_word(string_view word)
+{
+    // FNV-1a
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : word) {
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    return h;
+}
+
+WordTable::WordTable(size_t initial_capacity)
+    : slots(max<size_t>(16, initial_capacity))
+{
+}
+
+const char* WordTable::intern_word(string_view word)
+{
+    if (word.size() > arena_left) {
+        size_t block = max(ARENA_BLOCK, word.size());
+        arena.emplace_back(new char[block]);
+        arena_pos = arena.back().get();
+        arena_left = block;
+    }
+    char* dst = arena_pos;
+    memcpy(dst, word.data(), word.size());
+    arena_pos += word.size();
+    arena_left -= word.size();
+    return dst;
+}
+
+void WordTable::grow()
+{
+    vector<Entry> old(slots.size() * 2);
+    old.swap(slots);
+    size_t mask = slots.size() - 1;
+    for (const auto& e : old) {
+        if (!e.word) continue;
+        size_t i = e.hash & mask;
+        while (slots[i].word) i = (i + 1) & mask;
+        slots[i] = e;
+    }
+}
+
+void WordTable::add(string_view word, uint64_t hash, uint64_t count, bool intern)
+{
+    if ((used + 1) * 10 > slots.size() * 7) {
+        grow();
+    }
+
+    size_t mask = slots.size() - 1;
+    size_t i = hash & mask;
+    while (slots[i].word) {
+        Entry& e = slots[i];
+        if (e.hash == hash && e.length == word.size() && memcmp(e.word, word.data(), word.size()) == 0) {
+            e.count += count;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    Entry& e = slots[i];
+    e.hash = hash;
+    e.word = intern ? intern_word(word) : word.data();
+    e.length = static_cast<uint32_t>(word.size());
+    e.count = count;
+    used++;
+}
+
+size_t WordTable::count_words(const char* text, size_t size, bool fold_case, bool at_end, uint64_t& words)
+{
+    string folded;
+    size_t i = scan(text, 0, size, true);
+    while (i < size) {
+        size_t end = scan(text, i, size, false);
+        if (end == size && !at_end) {
+            return i;
+        }
+
+        string_view word(text + i, end - i);
+        if (fold_case) {
+            folded.assign(word);
+            for (auto& c : folded) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+            word = folded;
+        }
+        add(word, hash_word(word));
+        words++;
+
+        i = scan(text, end, size, true);
+    }
+    return size;
+}
+
+vector<pair<string, uint64_t>> merge_top_k(const vector<WordTable>& tables, size_t k, size_t threads)
+{
+    threads = max<size_t>(1, threads);
+    using Candidate = pair<uint64_t, string_view>;
+    vector<vector<Candidate>> partials(threads);
+    vector<thread> mergers;
+
+    for (size_t p = 0; p < threads; p++) {
+        mergers.emplace_back([&, p]() {
+            WordTable merged;
+            for (const auto& table : tables) {
+                table.for_each([&](const WordTable::Entry& e) {
+                    if ((e.hash >> 40) % threads == p) {
+                        merged.add(string_view(e.word, e.length), e.hash, e.count, false);
+                    }
+                });
+            }
+
+            // Min-heap of size k: the root is the weakest of the current best.
+            priority_queue<Candidate, vector<Candidate>, greater<Candidate>> heap;
+            merged.for_each([&](const WordTable::Entry& e) {
+                Candidate c(e.count, string_view(e.word, e.length));
+                if (heap.size() < k) {
+                    heap.push(c);
+                } else if (k > 0 && heap.top() < c) {
+                    heap.pop();
+                    heap.push(c);
+                }
+            });
+            while (!heap.empty()) {
+                partials[p].push_back(heap.top());
+                heap.pop();
+            }
+        });
+    }
+    for (auto& t : mergers) {
+        t.join();
+    }
+
+    vector<Candidate> all;
+    for (auto& part : partials) {
+        all.insert(all.end(), part.begin(), part.end());
+    }
+    size_t n = min(k, all.size());
+    partial_sort(all.begin(), all.begin() + n, all.end(), greater<Candidate>());
+
+    vector<pair<string, uint64_t>> top;
+    top.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        top.emplace_back(string(all[i].second), all[i].first);
+    }
+    return top;
+}
+
+void print_word_counts(const vector<WordTable>& tables, const Config& config, size_t threads, Shared& data)
+{
+    auto top = merge_top_k(tables, config.top_n ? config.top_n : 20, threads);
+    string out;
+    for (const auto& [word, count] : top) {
+        out += to_string(count) + " " + word + "\n";
+    }
+    data.emit(out);
+}
+
+void execute_wordcount(const string& filename, const Config& config, WordTable& table, Shared& data)
+{
+    auto start = chrono::high_resolution_clock::now();
+    unique_ptr<InputSource> input;
+    try {
+        input = open_input(filename);
+    } catch (const exception& e) {
+        Logger::getInstance().logError("Warning: Could not open file " + filename + ": " + e.what());
+        return;
+    }
+
+    vector<char> buffer(CHUNK_SIZE);
+    size_t carry = 0;
+    uint64_t words = 0;
+    bool done = false;
+
+    try {
+        while(!done && !data.stop.stop_requested()) {
+            if(carry == buffer.size()) {
+                buffer.resize(buffer.size() * 2);
+            }
+            size_t wanted = buffer.size() - carry;
+            size_t got = input->fill(buffer.data() + carry, wanted);
+            size_t filled = carry + got;
+            done = got < wanted;
+
+            size_t used = table.count_words(buffer.data(), filled, config.ignore_case, done, words);
+            carry = filled - used;
+            memmove(buffer.data(), buffer.data() + used, carry);
+        }
+    } catch (const exception& e) {
+        Logger::getInstance().logError("Error reading " + filename + ": " + e.what());
+    }
+
+    auto end = chrono::high_resolution_clock::now();
+    auto duration = chrono::duration_cast<chrono::milliseconds>(end - start).count();
+
+    std::unique_lock<std::shared_mutex> data_lock(data.data_mtx);
+    data.total_occ += words;
+    data_lock.unlock();
+
+    data.results.append(FileResult{filename, words, duration});
+}
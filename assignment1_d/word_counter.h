@@ -0,0 +1,73 @@
+#pragma once
+
+#include "config.h"
+#include "thread_safe.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Open-addressing (linear probing) map from word to count. Each distinct word
+// is copied exactly once into an arena owned by the table, so the hot path of
+// counting a word that was seen before allocates nothing.
+class WordTable {
+public:
+    struct Entry {
+        uint64_t hash = 0;
+        const char* word = nullptr;
+        uint32_t length = 0;
+        uint64_t count = 0;
+    };
+
+    explicit WordTable(size_t initial_capacity = 1 << 12);
+
+    WordTable(WordTable&&) = default;
+    WordTable& operator=(WordTable&&) = default;
+    WordTable(const WordTable&) = delete;
+    WordTable& operator=(const WordTable&) = delete;
+
+    static uint64_t hash_word(std::string_view word);
+
+    // With intern = false the table keeps pointing at the caller's bytes,
+    // which must then outlive it. Merging uses that to avoid copying words
+    // that already live in another table's arena.
+    void add(std::string_view word, uint64_t hash, uint64_t count = 1, bool intern = true);
+
+    // Splits text into words (runs of ASCII letters, digits and UTF-8 bytes)
+    // and counts them. Unless at_end is set, a word touching the end of the
+    // text may continue in the next chunk, so it is left alone. Returns the
+    // number of bytes consumed and adds the number of words counted to `words`.
+    size_t count_words(const char* text, size_t size, bool fold_case, bool at_end, uint64_t& words);
+
+    size_t size() const { return used; }
+
+    template <typename F>
+    void for_each(F&& f) const {
+        for (const auto& e : slots) {
+            if (e.word) f(e);
+        }
+    }
+
+private:
+    std::vector<Entry> slots;
+    size_t used = 0;
+
+    std::vector<std::unique_ptr<char[]>> arena;
+    char* arena_pos = nullptr;
+    size_t arena_left = 0;
+
+    const char* intern_word(std::string_view word);
+    void grow();
+};
+
+// Merges the per-thread tables in parallel and returns the k most frequent
+// words, most frequent first. The hash space is split into one partition per
+// merge thread, so no two threads ever touch the same word.
+std::vector<std::pair<std::string, uint64_t>> merge_top_k(const std::vector<WordTable>& tables, size_t k, size_t threads);
+
+// Merges the tables and prints "count word" lines, --top N (default 20) of them.
+void print_word_counts(const std::vector<WordTable>& tables, const Config& config, size_t threads, Shared& data);
+
+void execute_wordcount(const std::string& filename, const Config& config, WordTable& table, Shared& data);
@@ -0,0 +1,154 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <thread>
+#include <utility>
+
+// Append-only log that many threads can push into without a lock.
+//
+// Storage is a fixed directory of segments where segment k holds
+// first_segment << k slots. A writer claims an index with a single fetch_add,
+// allocates the segment holding that index if nobody has yet (first CAS wins),
+// constructs the element in place and marks the slot ready. Segments are never
+// moved or freed while the log lives, so an element's address is stable from
+// the moment it is appended, and a growing log never copies anything under a
+// lock the way std::vector::push_back does when it reallocates.
+template <typename T>
+class AppendLog {
+private:
+    static constexpr size_t first_segment_bits = 6;
+    static constexpr size_t first_segment = size_t(1) << first_segment_bits;
+    static constexpr size_t max_segments = 40;
+
+    struct Slot {
+        std::atomic<bool> ready{false};
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* item() { return std::launder(reinterpret_cast<T*>(storage)); }
+        const T* item() const { return std::launder(reinterpret_cast<const T*>(storage)); }
+    };
+
+    std::atomic<Slot*> segments[max_segments] = {};
+    std::atomic<size_t> next{0};
+
+    static size_t segment_size(size_t seg) { return first_segment << seg; }
+
+    // Index i lives in segment floor(log2(i / first_segment + 1)).
+    static void locate(size_t index, size_t& seg, size_t& offset) {
+        size_t biased = (index >> first_segment_bits) + 1;
+        seg = static_cast<size_t>(63 - __builtin_clzll(biased));
+        offset = index - ((segment_size(seg)) - first_segment);
+    }
+
+    Slot* segment(size_t seg) {
+        Slot* s = segments[seg].load(std::memory_order_acquire);
+        if (s) {
+            return s;
+        }
+        Slot* fresh = new Slot[segment_size(seg)];
+        if (segments[seg].compare_exchange_strong(s, fresh, std::memory_order_acq_rel)) {
+            return fresh;
+        }
+        delete[] fresh;
+        return s;
+    }
+
+    const Slot& slot(size_t index) const {
+        size_t seg, offset;
+        locate(index, seg, offset);
+        return segments[seg].load(std::memory_order_acquire)[offset];
+    }
+
+    // Null while the append that claimed the index has not installed its
+    // segment yet.
+    const Slot* claimed_slot(size_t index) const {
+        size_t seg, offset;
+        locate(index, seg, offset);
+        const Slot* s = segments[seg].load(std::memory_order_acquire);
+        return s ? &s[offset] : nullptr;
+    }
+
+public:
+    class Snapshot;
+
+    AppendLog() = default;
+
+    ~AppendLog() {
+        size_t n = next.load();
+        for (size_t i = 0; i < n; i++) {
+            size_t seg, offset;
+            locate(i, seg, offset);
+            Slot* s = segments[seg].load();
+            if (s && s[offset].ready.load()) {
+                s[offset].item()->~T();
+            }
+        }
+        for (auto& seg : segments) {
+            delete[] seg.load();
+        }
+    }
+
+    AppendLog(const AppendLog&) = delete;
+    AppendLog& operator=(const AppendLog&) = delete;
+
+    // Returns a reference that stays valid for the lifetime of the log.
+    template <typename... Args>
+    T& append(Args&&... args) {
+        size_t index = next.fetch_add(1, std::memory_order_relaxed);
+        size_t seg, offset;
+        locate(index, seg, offset);
+
+        Slot& s = segment(seg)[offset];
+        T* item = new (s.storage) T(std::forward<Args>(args)...);
+        s.ready.store(true, std::memory_order_release);
+        return *item;
+    }
+
+    // Number of slots claimed so far. Some of the newest may still be in the
+    // middle of being written, snapshot() waits for those.
+    size_t size() const { return next.load(std::memory_order_acquire); }
+
+    Snapshot snapshot() const { return Snapshot(*this, size()); }
+
+    // A fixed-length view over the first n elements. Every element in it is
+    // fully constructed, and later appends do not change what it shows.
+    class Snapshot {
+    private:
+        const AppendLog* log;
+        size_t count;
+
+    public:
+        Snapshot(const AppendLog& log, size_t count) : log(&log), count(count) {
+            // A claimed slot is always being filled by a running append(),
+            // so this wait is at most one segment allocation and one
+            // constructor long. The segment may not be there yet either.
+            for (size_t i = 0; i < count; i++) {
+                const Slot* s;
+                while (!(s = log.claimed_slot(i)) || !s->ready.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        const T& operator[](size_t i) const { return *log->slot(i).item(); }
+
+        class iterator {
+        private:
+            const Snapshot* snap;
+            size_t i;
+        public:
+            iterator(const Snapshot* snap, size_t i) : snap(snap), i(i) {}
+            const T& operator*() const { return (*snap)[i]; }
+            const T* operator->() const { return &(*snap)[i]; }
+            iterator& operator++() { ++i; return *this; }
+            bool operator!=(const iterator& other) const { return i != other.i; }
+            bool operator==(const iterator& other) const { return i == other.i; }
+        };
+
+        iterator begin() const { return iterator(this, 0); }
+        iterator end() const { return iterator(this, count); }
+    };
+};
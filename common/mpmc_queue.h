@@ -0,0 +1,161 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+// Bounded multi-producer multi-consumer queue, after Dmitry Vyukov's design.
+// Every cell carries a sequence number which tells a producer whether the cell
+// is free for the current lap and a consumer whether it has been filled, so the
+// only shared writes are one CAS on the head or tail index per operation.
+//
+// The batch calls claim a run of consecutive cells with that one CAS, so a
+// thread that has many items to hand over (or room for many) pays for the
+// contended index once per batch instead of once per item.
+template <typename T>
+class MPMCQueue {
+private:
+    static constexpr size_t cache_line = 64;
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* item() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    Cell* cells;
+    const size_t mask;
+
+    // Producers and consumers each hammer their own index, keep them apart.
+    // The alignment also rounds the queue's size up to whole lines, so
+    // nothing placed after it shares a line with dequeue_pos.
+    alignas(cache_line) std::atomic<size_t> enqueue_pos{0};
+    alignas(cache_line) std::atomic<size_t> dequeue_pos{0};
+
+    // Claims up to n consecutive cells starting at the index, which are ready
+    // when their sequence is pos + ready_offset: 0 for a producer (free for
+    // this lap), 1 for a consumer (filled). Returns the first position and
+    // how many were claimed, 0 if not even the first cell is ready.
+    std::pair<size_t, size_t> claim(std::atomic<size_t>& index, size_t n, size_t ready_offset) {
+        size_t pos = index.load(std::memory_order_relaxed);
+        if (n == 0) {
+            return {pos, 0};
+        }
+        while (true) {
+            size_t k = 0;
+            while (k < n && cells[(pos + k) & mask].sequence.load(std::memory_order_acquire) == pos + k + ready_offset) {
+                k++;
+            }
+            if (k > 0) {
+                if (index.compare_exchange_weak(pos, pos + k, std::memory_order_relaxed)) {
+                    return {pos, k};
+                }
+                continue;  // pos was reloaded by the failed CAS
+            }
+            size_t seq = cells[pos & mask].sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + ready_offset);
+            if (diff < 0) {
+                return {pos, 0};  // full, or empty
+            }
+            pos = index.load(std::memory_order_relaxed);
+        }
+    }
+
+public:
+    // Capacity must be a power of two.
+    explicit MPMCQueue(size_t capacity) : cells(nullptr), mask(capacity - 1) {
+        if (capacity < 2 || (capacity & (capacity - 1)) != 0) {
+            throw std::invalid_argument("MPMCQueue capacity must be a power of two");
+        }
+        cells = new Cell[capacity];
+        for (size_t i = 0; i < capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MPMCQueue() {
+        T discard;
+        while (try_pop(discard)) {}
+        delete[] cells;
+    }
+
+    MPMCQueue(const MPMCQueue&) = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    bool try_push(T&& value) {
+        Cell* cell;
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (cell->storage) T(std::move(value));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& out) {
+        Cell* cell;
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+
+        out = std::move(*cell->item());
+        cell->item()->~T();
+        cell->sequence.store(pos + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Moves items[0, k) into the queue for the largest k <= n that fits right
+    // now, and returns k. The k items keep their order and are not
+    // interleaved with other producers' items.
+    size_t try_push_batch(T* items, size_t n) {
+        auto [pos, k] = claim(enqueue_pos, n, 0);
+        for (size_t i = 0; i < k; i++) {
+            Cell& cell = cells[(pos + i) & mask];
+            new (cell.storage) T(std::move(items[i]));
+            cell.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return k;
+    }
+
+    // Moves up to n items, oldest first, into out[0, k) and returns k.
+    size_t try_pop_batch(T* out, size_t n) {
+        auto [pos, k] = claim(dequeue_pos, n, 1);
+        for (size_t i = 0; i < k; i++) {
+            Cell& cell = cells[(pos + i) & mask];
+            out[i] = std::move(*cell.item());
+            cell.item()->~T();
+            cell.sequence.store(pos + i + mask + 1, std::memory_order_release);
+        }
+        return k;
+    }
+};
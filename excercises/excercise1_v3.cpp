@@ -0,0 +1,246 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <mutex>
+#include <random>
+#include <future>
+#include <semaphore>
+#include <atomic>
+#include <algorithm>
+#include "../common/mpmc_queue.h"
+
+struct DeliveryOrder {
+  int order_id;
+  std::string destination;
+  // How long the simulated delivery takes. The defaults are the ones from the
+  // exercise, the benchmark below shrinks them so that 100k orders finish.
+  int min_ms = 500;
+  int max_ms = 2000;
+
+  std::string execute() {
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<> distrib(min_ms, max_ms);
+    int ms = distrib(gen);
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    return "Order " + std::to_string(order_id) + " delivered at " + destination + ".";
+  }
+};
+
+// excercise1_v2.cpp starts a brand new thread (Driver) for every order. That is
+// fine for 16 orders and hopeless for 100k. The Dispatcher keeps a fixed fleet
+// of drivers instead, and they pull orders from a lock-free queue until told
+// to stop. Each driver writes into its own logbook, so nothing is locked on
+// the hot path, and the logbooks are merged once everyone has returned.
+class Dispatcher {
+private:
+  struct Job {
+    std::unique_ptr<DeliveryOrder> order;
+    std::promise<std::string> result;
+  };
+
+  MPMCQueue<std::unique_ptr<Job>> queue;
+  // Counts the jobs sitting in the queue, idle drivers sleep on it instead of spinning.
+  std::counting_semaphore<> pending{0};
+  std::atomic<bool> stopping{false};
+
+  std::vector<std::thread> drivers;
+  std::vector<std::vector<std::string>> logbooks;
+
+  void drive(size_t id) {
+    std::vector<std::string>& logbook = logbooks[id];
+    while (true) {
+      pending.acquire();
+
+      std::unique_ptr<Job> job;
+      while (!queue.try_pop(job)) {
+        // The semaphore says there is a job, another driver may just be
+        // racing us for the same cell. Try again.
+        std::this_thread::yield();
+      }
+
+      // A null job is the signal to go home, see shutdown().
+      if (!job) {
+        return;
+      }
+
+      try {
+        std::string result = job->order->execute();
+        logbook.push_back(result);
+        job->result.set_value(std::move(result));
+      } catch (...) {
+        job->result.set_exception(std::current_exception());
+      }
+    }
+  }
+
+  void enqueue(std::unique_ptr<Job> job) {
+    while (!queue.try_push(std::move(job))) {
+      // Queue is full, let the drivers catch up.
+      std::this_thread::yield();
+    }
+    pending.release();
+  }
+
+public:
+  explicit Dispatcher(size_t fleet_size, size_t queue_capacity = 4096)
+    : queue(queue_capacity), logbooks(fleet_size)
+  {
+    drivers.reserve(fleet_size);
+    for (size_t i = 0; i < fleet_size; i++) {
+      drivers.emplace_back(&Dispatcher::drive, this, i);
+    }
+  }
+
+  ~Dispatcher() {
+    shutdown();
+  }
+
+  Dispatcher(const Dispatcher&) = delete;
+  Dispatcher& operator=(const Dispatcher&) = delete;
+
+  std::future<std::string> dispatch(std::unique_ptr<DeliveryOrder> order) {
+    auto job = std::make_unique<Job>();
+    job->order = std::move(order);
+    std::future<std::string> result = job->result.get_future();
+    enqueue(std::move(job));
+    return result;
+  }
+
+  // Lets every order already dispatched finish, then joins the fleet. One
+  // null job per driver is queued behind the real work, so no order is lost.
+  void shutdown() {
+    if (stopping.exchange(true)) {
+      return;
+    }
+    for (size_t i = 0; i < drivers.size(); i++) {
+      enqueue(nullptr);
+    }
+    for (auto& d : drivers) {
+      if (d.joinable()) {
+        d.join();
+      }
+    }
+  }
+
+  // Only meaningful after shutdown().
+  std::vector<std::string> merged_logbook() const {
+    size_t total = 0;
+    for (const auto& book : logbooks) {
+      total += book.size();
+    }
+
+    std::vector<std::string> merged;
+    merged.reserve(total);
+    for (const auto& book : logbooks) {
+      merged.insert(merged.end(), book.begin(), book.end());
+    }
+    return merged;
+  }
+};
+
+std::unique_ptr<DeliveryOrder> make_order(int id, int min_ms, int max_ms) {
+  auto order = std::make_unique<DeliveryOrder>();
+  order->order_id = id;
+  order->destination = "Sector " + std::to_string(id % 100);
+  order->min_ms = min_ms;
+  order->max_ms = max_ms;
+  return order;
+}
+
+// The design from excercise1_v2.cpp, boiled down: one thread per order and a
+// mutex protected logbook. Used as the baseline for the benchmark.
+double thread_per_driver(int orders, int min_ms, int max_ms) {
+  std::vector<std::string> logbook;
+  std::mutex mtx;
+  std::vector<std::thread> drivers;
+  drivers.reserve(orders);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < orders; i++) {
+    drivers.emplace_back([order = make_order(i, min_ms, max_ms), &logbook, &mtx]() {
+      std::string result = order->execute();
+      std::lock_guard<std::mutex> lock(mtx);
+      logbook.push_back(result);
+    });
+  }
+  for (auto& d : drivers) {
+    d.join();
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+
+  std::chrono::duration<double> elapsed = end - start;
+  return elapsed.count();
+}
+
+double worker_pool(int orders, int min_ms, int max_ms, size_t fleet_size) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  Dispatcher dispatcher(fleet_size);
+  std::vector<std::future<std::string>> results;
+  results.reserve(orders);
+  for (int i = 0; i < orders; i++) {
+    results.push_back(dispatcher.dispatch(make_order(i, min_ms, max_ms)));
+  }
+  for (auto& r : results) {
+    r.get();
+  }
+  dispatcher.shutdown();
+
+  auto end = std::chrono::high_resolution_clock::now();
+
+  if (dispatcher.merged_logbook().size() != static_cast<size_t>(orders)) {
+    std::cout << "Logbook is missing entries!" << std::endl;
+  }
+
+  std::chrono::duration<double> elapsed = end - start;
+  return elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+  std::cout << "Starting Program..." << std::endl;
+
+  const size_t fleet_size = std::max(1u, std::thread::hardware_concurrency());
+
+  {
+    Dispatcher dispatcher(fleet_size);
+    std::vector<std::future<std::string>> results;
+
+    std::cout << "\n--- Dispatching 16 orders to " << fleet_size << " drivers ---" << std::endl;
+    for (int i = 0; i < 16; i++) {
+      results.push_back(dispatcher.dispatch(make_order(i, 50, 200)));
+    }
+    for (auto& r : results) {
+      std::cout << r.get() << std::endl;
+    }
+
+    dispatcher.shutdown();
+    std::cout << "\n--- Logbook Contents ---" << std::endl;
+    for (const auto& entry : dispatcher.merged_logbook()) {
+      std::cout << entry << std::endl;
+    }
+  }
+
+  // Orders take 0-1 ms here so that the benchmark measures dispatch overhead
+  // rather than the simulated drive.
+  const int orders = argc > 1 ? std::stoi(argv[1]) : 100'000;
+  const int baseline_orders = argc > 2 ? std::stoi(argv[2]) : 10'000;
+  // Deliveries spend their time asleep, not on the CPU, so the fleet can be
+  // much bigger than the core count. It is still a fixed number of threads.
+  const size_t pool_size = argc > 3 ? std::stoul(argv[3]) : 256;
+
+  std::cout << "\n--- Benchmark ---" << std::endl;
+
+  double secs = thread_per_driver(baseline_orders, 0, 1);
+  std::cout << "(Thread per driver) " << baseline_orders << " orders: " << baseline_orders / secs << " orders/s" << std::endl;
+
+  secs = worker_pool(orders, 0, 1, pool_size);
+  std::cout << "(Pool of " << pool_size << " drivers) " << orders << " orders: " << orders / secs << " orders/s" << std::endl;
+
+  std::cout << "Finished." << std::endl;
+  return 0;
+}
@@ -0,0 +1,268 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <mutex>
+#include <random>
+#include <atomic>
+#include <latch>
+#include <semaphore>
+#include <coroutine>
+#include <algorithm>
+#include <exception>
+#include "../common/mpmc_queue.h"
+#include "../common/append_log.h"
+
+// One generator per thread, seeded once. excercise1_v3.cpp builds a
+// random_device and a mt19937 on every single execute() call, which costs more
+// than the rest of the order put together once the sleep is gone.
+static std::mt19937& thread_rng() {
+  thread_local std::mt19937 gen(std::random_device{}());
+  return gen;
+}
+
+// Bookkeeping for the benchmark: how many orders are in flight right now and
+// how much memory their coroutine frames hold.
+struct FlightStats {
+  std::atomic<size_t> in_flight{0};
+  std::atomic<size_t> peak_in_flight{0};
+  std::atomic<size_t> frame_bytes{0};
+  std::atomic<size_t> peak_frame_bytes{0};
+
+  static void raise(std::atomic<size_t>& peak, size_t value) {
+    size_t current = peak.load(std::memory_order_relaxed);
+    while (value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+  }
+};
+
+static FlightStats stats;
+
+// Hashed timer wheel with 1 ms ticks. Callers hand it a suspended coroutine
+// and a delay, a single ticker thread walks the slots and passes every
+// coroutine whose time has come to the executor threads to be resumed.
+// Nobody blocks in sleep_for, so the number of waiting orders is bounded by
+// memory rather than by threads.
+class TimerWheel {
+private:
+  struct Timer {
+    std::coroutine_handle<> handle;
+    size_t rounds;
+  };
+
+  static constexpr size_t slot_count = 4096;
+  std::vector<std::vector<Timer>> slots;
+  size_t current_tick = 0;
+
+  // New timers land here first so that the slots are only ever touched by the ticker.
+  std::mutex intake_mtx;
+  std::vector<std::pair<std::coroutine_handle<>, size_t>> intake;
+
+  MPMCQueue<std::coroutine_handle<>> ready;
+  std::counting_semaphore<> ready_count{0};
+
+  std::chrono::steady_clock::time_point epoch;
+  std::atomic<bool> stopping{false};
+  std::thread ticker;
+  std::vector<std::thread> executors;
+
+  size_t now_tick() const {
+    auto elapsed = std::chrono::steady_clock::now() - epoch;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+  }
+
+  void fire(std::coroutine_handle<> h) {
+    while (!ready.try_push(std::move(h))) {
+      std::this_thread::yield();
+    }
+    ready_count.release();
+  }
+
+  void tick_loop() {
+    std::vector<std::pair<std::coroutine_handle<>, size_t>> incoming;
+    while (!stopping.load()) {
+      {
+        std::lock_guard<std::mutex> lock(intake_mtx);
+        incoming.swap(intake);
+      }
+      for (auto& [h, deadline] : incoming) {
+        size_t delta = deadline > current_tick ? deadline - current_tick : 1;
+        slots[(current_tick + delta) % slot_count].push_back({h, (delta - 1) / slot_count});
+      }
+      incoming.clear();
+
+      // Catch up on every tick that has passed since we last looked.
+      size_t target = now_tick();
+      while (current_tick < target) {
+        current_tick++;
+        auto& slot = slots[current_tick % slot_count];
+        size_t kept = 0;
+        for (auto& timer : slot) {
+          if (timer.rounds == 0) {
+            fire(timer.handle);
+          } else {
+            timer.rounds--;
+            slot[kept++] = timer;
+          }
+        }
+        slot.resize(kept);
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  void execute_loop() {
+    while (true) {
+      ready_count.acquire();
+      std::coroutine_handle<> h;
+      while (!ready.try_pop(h)) {
+        std::this_thread::yield();
+      }
+      if (!h) {
+        return;
+      }
+      h.resume();
+    }
+  }
+
+public:
+  explicit TimerWheel(size_t executor_count)
+    : slots(slot_count), ready(1 << 16), epoch(std::chrono::steady_clock::now())
+  {
+    ticker = std::thread(&TimerWheel::tick_loop, this);
+    for (size_t i = 0; i < executor_count; i++) {
+      executors.emplace_back(&TimerWheel::execute_loop, this);
+    }
+  }
+
+  ~TimerWheel() {
+    stopping = true;
+    ticker.join();
+    for (size_t i = 0; i < executors.size(); i++) {
+      fire(nullptr);
+    }
+    for (auto& e : executors) {
+      e.join();
+    }
+  }
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  void schedule(std::coroutine_handle<> h, int ms) {
+    size_t deadline = now_tick() + std::max(ms, 1);
+    std::lock_guard<std::mutex> lock(intake_mtx);
+    intake.emplace_back(h, deadline);
+  }
+
+  struct SleepAwaiter {
+    TimerWheel& wheel;
+    int ms;
+
+    bool await_ready() const noexcept { return ms <= 0; }
+    // The coroutine may be resumed on an executor before this returns, so
+    // nothing here may touch the frame after scheduling.
+    void await_suspend(std::coroutine_handle<> h) { wheel.schedule(h, ms); }
+    void await_resume() const noexcept {}
+  };
+
+  SleepAwaiter sleep(int ms) { return SleepAwaiter{*this, ms}; }
+};
+
+// Fire-and-forget coroutine. It starts running as soon as it is called, and
+// the frame frees itself when the body finishes. Frame allocations are routed
+// through the promise so that the benchmark can see what each order costs.
+struct DeliveryTask {
+  struct promise_type {
+    DeliveryTask get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+
+    static void* operator new(size_t size) {
+      size_t now = stats.frame_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+      FlightStats::raise(stats.peak_frame_bytes, now);
+      return ::operator new(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+      stats.frame_bytes.fetch_sub(size, std::memory_order_relaxed);
+      ::operator delete(ptr);
+    }
+  };
+};
+
+struct DeliveryOrder {
+  int order_id;
+  std::string destination;
+
+  // The blocking version, still here for comparison. Only the RNG changed.
+  std::string execute() {
+    std::uniform_int_distribution<> distrib(500, 2000);
+    int ms = distrib(thread_rng());
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    return "Order " + std::to_string(order_id) + " delivered at " + destination + ".";
+  }
+};
+
+// Executors finish orders in bursts (every order due in the same tick is
+// resumed at once), which is exactly when a mutex around a reallocating vector
+// hurts the most. The append-only log takes no lock at all.
+using Logbook = AppendLog<std::string>;
+
+// The asynchronous version of execute(). Instead of parking the thread, the
+// order parks itself on the wheel and whichever executor picks it up later
+// finishes the delivery.
+DeliveryTask deliver(std::unique_ptr<DeliveryOrder> order, TimerWheel& wheel, Logbook& logbook, std::latch& done) {
+  size_t now = stats.in_flight.fetch_add(1, std::memory_order_relaxed) + 1;
+  FlightStats::raise(stats.peak_in_flight, now);
+
+  std::uniform_int_distribution<> distrib(500, 2000);
+  co_await wheel.sleep(distrib(thread_rng()));
+
+  logbook.append("Order " + std::to_string(order->order_id) + " delivered at " + order->destination + ".");
+  stats.in_flight.fetch_sub(1, std::memory_order_relaxed);
+  done.count_down();
+}
+
+int main(int argc, char* argv[]) {
+  std::cout << "Starting Program..." << std::endl;
+
+  const int orders = argc > 1 ? std::stoi(argv[1]) : 200'000;
+  const size_t executor_count = argc > 2 ? std::stoul(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+
+  Logbook logbook;
+  std::latch done(orders);
+
+  std::cout << "\n--- Dispatching " << orders << " orders onto " << executor_count << " executor threads ---" << std::endl;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  {
+    TimerWheel wheel(executor_count);
+
+    for (int i = 0; i < orders; i++) {
+      auto order = std::make_unique<DeliveryOrder>();
+      order->order_id = i;
+      order->destination = "Sector " + std::to_string(i % 100);
+      deliver(std::move(order), wheel, logbook, done);
+    }
+
+    done.wait();
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double> elapsed = end - start;
+
+  size_t peak = stats.peak_in_flight.load();
+  size_t per_order = peak ? stats.peak_frame_bytes.load() / peak + sizeof(DeliveryOrder) : 0;
+
+  std::cout << "Delivered " << logbook.snapshot().size() << " orders in " << elapsed.count() * 1000 << " ms." << std::endl;
+  std::cout << "Peak orders in flight: " << peak << std::endl;
+  std::cout << "Memory per in-flight order: ~" << per_order << " bytes (coroutine frame + order)" << std::endl;
+  std::cout << "Finished." << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,297 @@
+#include <iostream>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <algorithm>
+
+// Balances are kept in whole cents. With doubles, a million transfers would
+// accumulate rounding error and the conservation check below would be useless.
+using Cents = long long;
+
+class Account {
+private:
+    Cents balance;
+    std::mutex mtx;
+    std::string account_name;
+public:
+    explicit Account(Cents balance, const std::string& name) : balance(balance), account_name(name) {}
+
+    Account(const Account&) = delete;
+    Account& operator=(const Account&) = delete;
+
+    void withdraw(Cents amount) {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (amount > balance) {
+            throw std::runtime_error("Insufficient funds");
+        }
+        balance -= amount;
+    }
+
+    void deposit(Cents amount) {
+        std::lock_guard<std::mutex> lock(mtx);
+        balance += amount;
+    }
+
+    Cents checkBalance() {
+        std::lock_guard<std::mutex> lock(mtx);
+        return balance;
+    }
+
+    friend class Ledger;
+};
+
+// Same idea, without any mutex. A withdrawal is a CAS loop so that the balance
+// can never go negative, a deposit is a plain fetch_add.
+class AtomicAccount {
+private:
+    std::atomic<Cents> balance;
+public:
+    explicit AtomicAccount(Cents balance) : balance(balance) {}
+
+    AtomicAccount(const AtomicAccount&) = delete;
+    AtomicAccount& operator=(const AtomicAccount&) = delete;
+
+    bool try_withdraw(Cents amount) {
+        Cents current = balance.load(std::memory_order_relaxed);
+        while (current >= amount) {
+            if (balance.compare_exchange_weak(current, current - amount, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void deposit(Cents amount) {
+        balance.fetch_add(amount, std::memory_order_acq_rel);
+    }
+
+    Cents checkBalance() const {
+        return balance.load(std::memory_order_acquire);
+    }
+};
+
+// The fix for excercise2.cpp. transfer() there locks `from` and then `to`, so
+// a->b and b->a running together can each hold one lock and wait forever for
+// the other. Here both mutexes are taken through std::lock (the same deadlock
+// avoidance algorithm std::scoped_lock uses), so the order the accounts are
+// passed in no longer matters.
+class Ledger {
+private:
+    std::vector<std::unique_ptr<Account>> accounts;
+    std::atomic<size_t> contended{0};
+    std::atomic<size_t> rejected{0};
+
+public:
+    Ledger(size_t count, Cents opening_balance) {
+        accounts.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            accounts.push_back(std::make_unique<Account>(opening_balance, "acc" + std::to_string(i)));
+        }
+    }
+
+    size_t size() const { return accounts.size(); }
+
+    // Returns false (and moves nothing) when `from` cannot cover the amount.
+    bool transfer(size_t from_idx, size_t to_idx, Cents amount) {
+        if (from_idx == to_idx) {
+            return true;
+        }
+
+        Account& from = *accounts[from_idx];
+        Account& to = *accounts[to_idx];
+
+        // Try the cheap path first so that we can count how often a transfer
+        // actually had to wait for another thread. This is what the benchmark
+        // reports as contention.
+        std::unique_lock<std::mutex> lock_from(from.mtx, std::defer_lock);
+        std::unique_lock<std::mutex> lock_to(to.mtx, std::defer_lock);
+        if (std::try_lock(lock_from, lock_to) != -1) {
+            contended.fetch_add(1, std::memory_order_relaxed);
+            std::lock(lock_from, lock_to);
+        }
+
+        if (from.balance < amount) {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        from.balance -= amount;
+        to.balance += amount;
+        return true;
+    }
+
+    // Conservation-of-money check. Every account is locked in index order
+    // before anything is read, so the sum is a consistent snapshot even while
+    // transfers are still running. Transfers never block while holding a
+    // lock (std::lock backs off instead), so this cannot deadlock with them.
+    Cents audit() {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        locks.reserve(accounts.size());
+        Cents total = 0;
+        for (auto& acc : accounts) {
+            locks.emplace_back(acc->mtx);
+            total += acc->balance;
+        }
+        return total;
+    }
+
+    size_t contention_count() const { return contended.load(); }
+    size_t rejected_count() const { return rejected.load(); }
+};
+
+class AtomicLedger {
+private:
+    std::vector<std::unique_ptr<AtomicAccount>> accounts;
+    std::atomic<size_t> rejected{0};
+
+public:
+    AtomicLedger(size_t count, Cents opening_balance) {
+        accounts.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            accounts.push_back(std::make_unique<AtomicAccount>(opening_balance));
+        }
+    }
+
+    size_t size() const { return accounts.size(); }
+
+    // Money is briefly "in flight" between the withdraw and the deposit, so
+    // unlike Ledger::audit the sum here is only exact once all threads are done.
+    bool transfer(size_t from_idx, size_t to_idx, Cents amount) {
+        if (from_idx == to_idx) {
+            return true;
+        }
+        if (!accounts[from_idx]->try_withdraw(amount)) {
+            rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        accounts[to_idx]->deposit(amount);
+        return true;
+    }
+
+    Cents audit() const {
+        Cents total = 0;
+        for (const auto& acc : accounts) {
+            total += acc->checkBalance();
+        }
+        return total;
+    }
+
+    size_t rejected_count() const { return rejected.load(); }
+};
+
+template <typename LedgerT>
+double run_transfers(LedgerT& ledger, int thread_count, size_t transfers_per_thread, bool with_auditor, Cents expected, bool& invariant_ok) {
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+    std::atomic<bool> done{false};
+    invariant_ok = true;
+
+    std::thread auditor;
+    if (with_auditor) {
+        auditor = std::thread([&]() {
+            while (!done.load()) {
+                if (ledger.audit() != expected) {
+                    invariant_ok = false;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        });
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([&ledger, t, transfers_per_thread]() {
+            std::mt19937 gen(t + 1);
+            std::uniform_int_distribution<size_t> pick(0, ledger.size() - 1);
+            std::uniform_int_distribution<Cents> amount(1, 500);
+            for (size_t i = 0; i < transfers_per_thread; i++) {
+                ledger.transfer(pick(gen), pick(gen), amount(gen));
+            }
+        });
+    }
+
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    done = true;
+    if (auditor.joinable()) {
+        auditor.join();
+    }
+
+    if (ledger.audit() != expected) {
+        invariant_ok = false;
+    }
+
+    std::chrono::duration<double> elapsed = end - start;
+    return elapsed.count();
+}
+
+// Two threads repeatedly moving money in opposite directions between the same
+// pair of accounts. This is exactly the schedule that hangs excercise2.cpp.
+void opposite_direction_check() {
+    Ledger ledger(2, 1000 * 100);
+    const size_t rounds = 200'000;
+
+    std::thread t1([&]() {
+        for (size_t i = 0; i < rounds; i++) ledger.transfer(0, 1, 10 * 100);
+    });
+    std::thread t2([&]() {
+        for (size_t i = 0; i < rounds; i++) ledger.transfer(1, 0, 20 * 100);
+    });
+
+    t1.join();
+    t2.join();
+
+    std::cout << "Opposite direction transfers finished without deadlock. Total: "
+              << ledger.audit() << " (expected " << 2 * 1000 * 100 << ")" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    size_t account_count = argc > 1 ? std::stoul(argv[1]) : 4096;
+    size_t total_transfers = argc > 2 ? std::stoul(argv[2]) : 4'000'000;
+    const Cents opening = 1000 * 100;
+    const Cents expected = opening * static_cast<Cents>(account_count);
+
+    opposite_direction_check();
+
+    std::cout << "\n--- " << total_transfers << " transfers over " << account_count << " accounts ---" << std::endl;
+
+    const int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> thread_counts;
+    for (int t = 1; t <= 2 * max_threads; t *= 2) {
+        thread_counts.push_back(t);
+    }
+
+    for (int threads : thread_counts) {
+        size_t per_thread = total_transfers / threads;
+
+        Ledger ledger(account_count, opening);
+        bool ok = false;
+        double secs = run_transfers(ledger, threads, per_thread, true, expected, ok);
+        double contention = 100.0 * ledger.contention_count() / (per_thread * threads);
+
+        std::cout << "(scoped_lock, " << threads << " Threads) "
+                  << (per_thread * threads) / secs / 1e6 << " M transfers/s, "
+                  << contention << "% contended, "
+                  << ledger.rejected_count() << " rejected, invariant "
+                  << (ok ? "held" : "VIOLATED") << std::endl;
+
+        AtomicLedger atomic_ledger(account_count, opening);
+        secs = run_transfers(atomic_ledger, threads, per_thread, false, expected, ok);
+
+        std::cout << "(CAS,         " << threads << " Threads) "
+                  << (per_thread * threads) / secs / 1e6 << " M transfers/s, "
+                  << atomic_ledger.rejected_count() << " rejected, invariant "
+                  << (ok ? "held" : "VIOLATED") << std::endl;
+    }
+
+    return 0;
+}
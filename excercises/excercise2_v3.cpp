@@ -0,0 +1,216 @@
+#include <iostream>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <algorithm>
+
+using Cents = long long;
+
+struct Transfer {
+    size_t from;
+    size_t to;
+    Cents amount;
+};
+
+// In excercise2_v2.cpp every Account owns its own mutex, so a transfer always
+// costs two lock round trips. Here the accounts are striped over a fixed number
+// of shards and a whole batch of transfers is applied while holding each shard
+// it touches exactly once.
+class ShardedLedger {
+private:
+    // Each shard mutex sits on its own cache line, otherwise threads locking
+    // neighbouring shards would still fight over the same line.
+    struct alignas(64) Shard {
+        std::mutex mtx;
+    };
+
+    std::vector<Cents> balances;
+    std::unique_ptr<Shard[]> shards;
+    size_t shard_count;
+
+    size_t shard_of(size_t account) const { return account % shard_count; }
+
+    // Locks every marked shard in ascending index order. Batches always go
+    // through here, so two of them can never wait on each other in a cycle.
+    // (A single transfer uses std::lock instead, which never blocks while
+    // holding a lock, so it cannot close a cycle either.)
+    std::vector<std::unique_lock<std::mutex>> lock_shards(const std::vector<char>& marked) {
+        std::vector<std::unique_lock<std::mutex>> locks;
+        for (size_t id = 0; id < shard_count; id++) {
+            if (marked[id]) {
+                locks.emplace_back(shards[id].mtx);
+            }
+        }
+        return locks;
+    }
+
+public:
+    ShardedLedger(size_t count, Cents opening_balance, size_t shard_count)
+        : balances(count, opening_balance), shards(new Shard[shard_count]), shard_count(shard_count) {}
+
+    ShardedLedger(const ShardedLedger&) = delete;
+    ShardedLedger& operator=(const ShardedLedger&) = delete;
+
+    size_t size() const { return balances.size(); }
+
+    // The old single operation path, kept for comparison.
+    void transfer(size_t from, size_t to, Cents amount) {
+        size_t a = shard_of(from), b = shard_of(to);
+        std::unique_lock<std::mutex> lock_a(shards[a].mtx, std::defer_lock);
+        std::unique_lock<std::mutex> lock_b;
+        if (a == b) {
+            lock_a.lock();
+        } else {
+            lock_b = std::unique_lock<std::mutex>(shards[b].mtx, std::defer_lock);
+            std::lock(lock_a, lock_b);
+        }
+
+        if (amount > balances[from]) {
+            throw std::runtime_error("Insufficient funds");
+        }
+        balances[from] -= amount;
+        balances[to] += amount;
+    }
+
+    // Applies the whole batch or nothing. Transfers are applied in order while
+    // every involved shard is held, and an undo log is kept so that if one of
+    // them runs out of funds the earlier ones are rolled back before throwing.
+    // Nobody else can observe the intermediate state since we still hold the locks.
+    void apply_batch(const std::vector<Transfer>& batch) {
+        std::vector<char> marked(shard_count, 0);
+        for (const auto& t : batch) {
+            marked[shard_of(t.from)] = 1;
+            marked[shard_of(t.to)] = 1;
+        }
+        auto locks = lock_shards(marked);
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            const Transfer& t = batch[i];
+            if (t.amount > balances[t.from]) {
+                for (size_t j = i; j-- > 0;) {
+                    balances[batch[j].from] += batch[j].amount;
+                    balances[batch[j].to] -= batch[j].amount;
+                }
+                throw std::runtime_error("Insufficient funds in transfer " + std::to_string(i) + " of batch");
+            }
+            balances[t.from] -= t.amount;
+            balances[t.to] += t.amount;
+        }
+    }
+
+    Cents audit() {
+        auto locks = lock_shards(std::vector<char>(shard_count, 1));
+
+        Cents total = 0;
+        for (Cents b : balances) total += b;
+        return total;
+    }
+
+    Cents checkBalance(size_t account) {
+        std::lock_guard<std::mutex> lock(shards[shard_of(account)].mtx);
+        return balances[account];
+    }
+};
+
+void rollback_check() {
+    ShardedLedger ledger(4, 100, 2);
+    std::vector<Transfer> batch = { {0, 1, 50}, {1, 2, 120}, {3, 0, 500} };
+
+    try {
+        ledger.apply_batch(batch);
+        std::cout << "Rollback check: batch unexpectedly succeeded." << std::endl;
+    } catch (const std::runtime_error& e) {
+        bool untouched = true;
+        for (size_t i = 0; i < 4; i++) {
+            untouched = untouched && ledger.checkBalance(i) == 100;
+        }
+        std::cout << "Rollback check: " << e.what() << ", balances "
+                  << (untouched ? "untouched" : "PARTIALLY APPLIED") << "." << std::endl;
+    }
+}
+
+double run(ShardedLedger& ledger, int thread_count, size_t transfers_per_thread, size_t batch_size, size_t& failed) {
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+    std::atomic<size_t> failures{0};
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (int t = 0; t < thread_count; t++) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 gen(t + 1);
+            std::uniform_int_distribution<size_t> pick(0, ledger.size() - 1);
+            std::uniform_int_distribution<Cents> amount(1, 500);
+            std::vector<Transfer> batch;
+            batch.reserve(batch_size);
+
+            for (size_t i = 0; i < transfers_per_thread; i++) {
+                Transfer tr{pick(gen), pick(gen), amount(gen)};
+                try {
+                    if (batch_size <= 1) {
+                        ledger.transfer(tr.from, tr.to, tr.amount);
+                        continue;
+                    }
+                    batch.push_back(tr);
+                    if (batch.size() == batch_size || i + 1 == transfers_per_thread) {
+                        ledger.apply_batch(batch);
+                        batch.clear();
+                    }
+                } catch (const std::runtime_error&) {
+                    failures.fetch_add(1, std::memory_order_relaxed);
+                    batch.clear();
+                }
+            }
+        });
+    }
+
+    for (auto& th : threads) {
+        th.join();
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    failed = failures.load();
+    std::chrono::duration<double> elapsed = end - start;
+    return elapsed.count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t account_count = argc > 1 ? std::stoul(argv[1]) : 4096;
+    size_t total_transfers = argc > 2 ? std::stoul(argv[2]) : 4'000'000;
+    size_t shard_count = argc > 3 ? std::stoul(argv[3]) : 64;
+    size_t batch_size = argc > 4 ? std::stoul(argv[4]) : 32;
+    const Cents opening = 1000 * 100;
+    const Cents expected = opening * static_cast<Cents>(account_count);
+
+    rollback_check();
+
+    std::cout << "\n--- " << total_transfers << " transfers over " << account_count << " accounts, "
+              << shard_count << " shards, batches of " << batch_size << " ---" << std::endl;
+
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        size_t per_thread = total_transfers / threads;
+        // Counted per phase, a transfer and a batch are different things.
+        size_t single_failed = 0, batch_failed = 0;
+
+        ShardedLedger single(account_count, opening, shard_count);
+        double single_secs = run(single, threads, per_thread, 1, single_failed);
+        bool single_ok = single.audit() == expected;
+
+        ShardedLedger batched(account_count, opening, shard_count);
+        double batch_secs = run(batched, threads, per_thread, batch_size, batch_failed);
+        bool batch_ok = batched.audit() == expected;
+
+        std::cout << "(" << threads << " Threads) single: " << (per_thread * threads) / single_secs / 1e6
+                  << " M/s (" << single_failed << " transfers refused), batched: " << (per_thread * threads) / batch_secs / 1e6
+                  << " M/s (" << batch_failed << " batches rolled back), invariant "
+                  << (single_ok && batch_ok ? "held" : "VIOLATED") << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Count-only search over the large corpus through the worker pool, with the
+// workers floating freely and pinned (--pin), and with each search buffer
+// placement (--numa-buffers). Each configuration runs in a fresh process so
+// that the thread-local buffers are placed anew.
+//
+// Build from the repository root:
+//   g++ -O2 -std=c++20 -pthread tests/affinity_bench.cpp assignment1_d/adaptive_pool.cpp assignment1_d/placement.cpp assignment1_d/file_processor.cpp assignment1_d/json_writer.cpp assignment1_d/input_source.cpp assignment1_d/logger.cpp assignment1_d/utf8_fold.cpp -lz -o affinity_bench
+//   ./affinity_bench [files...]      (default: dataset/large/*.txt from generator_large)
+#include "../assignment1_d/adaptive_pool.h"
+#include "../assignment1_d/file_processor.h"
+#include "../assignment1_d/placement.h"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <filesystem>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+double run(const std::vector<std::string>& files, bool pin, const std::string& buffers, size_t& count)
+{
+  Config config;
+  config.pattern = "hello";
+  config.count_only = true;
+  config.files = files;
+  config.numa_buffers = buffers;
+
+  Shared data;
+  auto start = std::chrono::steady_clock::now();
+  AdaptivePool pool(data, files.size());
+  if (pin) {
+    std::vector<int> home;
+    for (const auto& f : files) home.push_back(file_home_node(f));
+    pool.pin(home);
+  }
+  pool.run([&](size_t i) { execute_search(files[i], config, data); });
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  count = data.total_occ;
+  return elapsed.count();
+}
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::string> files(argv + 1, argv + argc);
+  if (files.empty() && fs::is_directory("dataset/large")) {
+    for (const auto& entry : fs::directory_iterator("dataset/large")) files.push_back(entry.path().string());
+  }
+  if (files.empty()) {
+    std::cerr << "No corpus: run dataset/generator_large first, or pass files." << std::endl;
+    return 1;
+  }
+  double mb = 0;
+  for (const auto& f : files) mb += fs::file_size(f) / 1e6;
+
+  const NumaTopology& topology = NumaTopology::get();
+  std::cout << files.size() << " files, " << mb << " MB, " << topology.nodes() << " NUMA node(s), best of 3 warm runs" << std::endl;
+
+  struct Setup { const char* name; bool pin; const char* buffers; };
+  for (Setup s : {Setup{"floating", false, ""}, Setup{"pinned", true, ""},
+                  Setup{"pinned, local buffers", true, "local"}, Setup{"pinned, interleaved buffers", true, "interleave"}}) {
+    int pipe_fd[2];
+    if (pipe(pipe_fd) != 0) return 1;
+    pid_t child = fork();
+    if (child == 0) {
+      double best = 1e30;
+      size_t count = 0;
+      for (int i = 0; i < 4; i++) {
+        double t = run(files, s.pin, s.buffers, count);
+        if (i > 0) best = std::min(best, t);   // the first run warms the page cache
+      }
+      double result[2] = {best, static_cast<double>(count)};
+      if (write(pipe_fd[1], result, sizeof(result)) != sizeof(result)) _exit(1);
+      _exit(0);
+    }
+    close(pipe_fd[1]);
+    double result[2] = {0, 0};
+    if (read(pipe_fd[0], result, sizeof(result)) != sizeof(result)) return 1;
+    close(pipe_fd[0]);
+    waitpid(child, nullptr, 0);
+    std::cout << "(" << s.name << ") " << mb / result[0] << " MB/s, " << static_cast<size_t>(result[1]) << " matches" << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+// --json output cost. First the record writer alone: match records built with
+// JsonWriter into a reused buffer, against the same records built the way the
+// text output is (string concatenation and to_string). Then whole searches to
+// /dev/null, count only against --json, with a common word so that a record
+// goes out every few lines.
+//
+// Build from the repository root:
+//   g++ -O2 -std=c++20 -pthread tests/json_bench.cpp assignment1_d/json_writer.cpp assignment1_d/file_processor.cpp assignment1_d/input_source.cpp assignment1_d/logger.cpp assignment1_d/utf8_fold.cpp assignment1_d/placement.cpp -lz -o json_bench
+//   ./json_bench [size_mb]
+#include "../assignment1_d/json_writer.h"
+#include "../assignment1_d/file_processor.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+
+const char* CORPUS_PATH = "/tmp/json_bench.txt";
+
+std::vector<std::string> make_lines(size_t target_bytes)
+{
+  const char* words[] = {"hello", "world", "the", "thread", "mutex", "queue", "caf\xc3\xa9", "\"quoted\"", "tab\there"};
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int> pick(0, 8);
+  std::vector<std::string> lines;
+  size_t written = 0;
+  while (written < target_bytes) {
+    std::string line;
+    for (int i = 0; i < 12; i++) {
+      line += words[pick(gen)];
+      line += ' ';
+    }
+    written += line.size() + 1;
+    lines.push_back(std::move(line));
+  }
+  return lines;
+}
+
+// What a record costs when built like the text output is.
+std::string escape(std::string_view s)
+{
+  std::string r;
+  for (char c : s) {
+    if (c == '"' || c == '\\') r += std::string("\\") + c;
+    else if (c == '\t') r += "\\t";
+    else r += c;
+  }
+  return r;
+}
+
+size_t concatenated(const std::vector<std::string>& lines)
+{
+  size_t bytes = 0;
+  for (size_t i = 0; i < lines.size(); i++) {
+    std::string record = "{\"type\":\"match\",\"file\":\"" + escape("dataset/large/file_3.txt") + "\",\"line\":" +
+                         std::to_string(i + 1) + ",\"offset\":" + std::to_string(i * 80) + ",\"match\":\"" +
+                         escape("hello") + "\",\"text\":\"" + escape(lines[i]) + "\"}\n";
+    bytes += record.size();
+  }
+  return bytes;
+}
+
+size_t writer(const std::vector<std::string>& lines)
+{
+  static std::string out;
+  size_t bytes = 0;
+  for (size_t i = 0; i < lines.size(); i++) {
+    JsonWriter(out).begin("match").text("file", "dataset/large/file_3.txt").number("line", i + 1)
+        .number("offset", i * 80).text("match", "hello").text("text", lines[i]).end();
+    // Emitted a megabyte at a time, like the search does.
+    if (out.size() >= 1 << 20) {
+      bytes += out.size();
+      out.clear();
+    }
+  }
+  bytes += out.size();
+  out.clear();
+  return bytes;
+}
+
+size_t search(Config& config, int null_fd)
+{
+  Shared data;
+  data.out_fd = null_fd;
+  auto result = execute_search(CORPUS_PATH, config, data);
+  return result ? result->count : 0;
+}
+
+double best_seconds(const std::function<size_t()>& run, size_t& result)
+{
+  double best = 1e30;
+  for (int i = 0; i < 5; i++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    result = run();
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+int main(int argc, char* argv[])
+{
+  size_t mb = argc > 1 ? std::stoul(argv[1]) : 256;
+  auto lines = make_lines(mb * 1024 * 1024);
+  std::cout << lines.size() << " match records over " << mb << " MB of lines, best of 5 runs" << std::endl;
+
+  size_t plain_bytes, json_bytes;
+  double plain = best_seconds([&]() { return concatenated(lines); }, plain_bytes);
+  double fast = best_seconds([&]() { return writer(lines); }, json_bytes);
+  std::cout << "(records, concatenated) " << plain_bytes / plain / 1e6 << " MB/s of JSON, " << lines.size() / plain / 1e6 << " M records/s" << std::endl;
+  std::cout << "(records, JsonWriter) " << json_bytes / fast / 1e6 << " MB/s of JSON, " << lines.size() / fast / 1e6 << " M records/s, "
+            << plain / fast << "x, " << (plain_bytes == json_bytes ? "same output size" : "OUTPUT SIZE DIFFERS") << std::endl;
+
+  {
+    std::ofstream out(CORPUS_PATH);
+    for (const auto& line : lines) out << line << '\n';
+  }
+  int null_fd = open("/dev/null", O_WRONLY);
+  for (const char* pattern : {"hello", "zebra"}) {
+    Config config;
+    config.pattern = pattern;
+    config.files = {CORPUS_PATH};
+    config.count_only = true;
+    size_t expected, got;
+    double count = best_seconds([&]() { return search(config, null_fd); }, expected);
+    config.count_only = false;
+    config.print_lines = config.line_number = true;
+    double text = best_seconds([&]() { return search(config, null_fd); }, got);
+    config.json = true;
+    double json = best_seconds([&]() { return search(config, null_fd); }, got);
+    std::cout << "(search " << pattern << ", " << expected << " matches) count " << mb / count << " MB/s, -p -n "
+              << mb / text << " MB/s, --json " << mb / json << " MB/s" << (got == expected ? "" : ", COUNT DIFFERS") << std::endl;
+  }
+  close(null_fd);
+  unlink(CORPUS_PATH);
+  return 0;
+}
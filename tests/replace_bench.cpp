@@ -0,0 +1,158 @@
+// Find-and-replace over many small files: the old per-file rewrite
+// (getline/endl into name.tmp, remove, rename), the same with an fsync per
+// file so it is as durable, and the ReplaceTransaction used by `-r` now.
+// Then one large file with a same-length swap, rewritten by the transaction
+// and patched by replace_in_place (`-r --in-place`).
+//
+// Build from the repository root:
+//   g++ -O2 -std=c++20 -pthread tests/replace_bench.cpp assignment1_d/replace.cpp assignment1_d/rules.cpp assignment1_d/logger.cpp -o replace_bench
+//   ./replace_bench [files] [dir] [large_mb]
+#include "../assignment1_d/replace.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+std::vector<std::string> make_files(const std::string& dir, size_t count)
+{
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  std::string line = "the quick brown fox says hello to the lazy dog and hello again\n";
+  std::string text;
+  while (text.size() < 8192) text += line;
+
+  std::vector<std::string> files;
+  for (size_t i = 0; i < count; i++) {
+    files.push_back(dir + "/file" + std::to_string(i) + ".txt");
+    std::ofstream(files.back()) << text;
+  }
+  return files;
+}
+
+// What execute_replace did before the transaction.
+void old_replace(const std::string& filename, const Config& config, bool durable)
+{
+  std::ifstream infile(filename);
+  std::string temp_filename = filename + ".tmp";
+  std::ofstream outfile(temp_filename);
+  std::string line;
+  while (std::getline(infile, line)) {
+    std::string out;
+    size_t last = 0, pos;
+    while ((pos = line.find(config.pattern, last)) != std::string::npos) {
+      out.append(line, last, pos - last);
+      out += config.replacement;
+      last = pos + config.pattern.size();
+    }
+    out.append(line, last);
+    outfile << out << std::endl;
+  }
+  infile.close();
+  outfile.close();
+  if (durable) {
+    int fd = open(temp_filename.c_str(), O_RDONLY);
+    fsync(fd);
+    close(fd);
+  }
+  std::remove(filename.c_str());
+  std::rename(temp_filename.c_str(), filename.c_str());
+}
+
+void report(const std::string& name, size_t files, std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "(" << name << ") " << files / elapsed.count() << " files/s" << std::endl;
+}
+
+// A config dump: key=value lines, one in a thousand has the token to swap.
+std::string make_large_file(const std::string& dir, size_t mb)
+{
+  fs::create_directories(dir);
+  std::string path = dir + "/large.conf";
+  std::ofstream out(path);
+  std::string block;
+  for (int i = 0; i < 1000; i++) {
+    block += "service.endpoint." + std::to_string(i) + (i == 0 ? "=node-old-01\n" : "=node-new-01\n");
+  }
+  for (size_t written = 0; written < mb << 20; written += block.size()) out << block;
+  return path;
+}
+
+int main(int argc, char* argv[])
+{
+  size_t count = argc > 1 ? std::stoul(argv[1]) : 2000;
+  std::string dir = argc > 2 ? argv[2] : "replace_bench_files";
+
+  Config config;
+  config.pattern = "hello";
+  config.replacement = "howdy";
+  config.replace_mode = true;
+
+  // The transaction logs a line per file, keep that out of the numbers.
+  int saved_stdout = dup(STDOUT_FILENO);
+  auto quiet = [&]() { int null = open("/dev/null", O_WRONLY); dup2(null, STDOUT_FILENO); close(null); };
+  auto loud = [&]() { std::cout.flush(); dup2(saved_stdout, STDOUT_FILENO); };
+
+  std::cout << count << " files of 8 KB in " << dir << std::endl;
+
+  for (bool durable : {false, true}) {
+    auto files = make_files(dir, count);
+    sync();
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& f : files) old_replace(f, config, durable);
+    if (durable) sync();
+    report(durable ? "old, fsync per file" : "old, no fsync", count, start);
+  }
+
+  auto files = make_files(dir, count);
+  sync();
+  quiet();
+  auto start = std::chrono::steady_clock::now();
+  {
+    ReplaceTransaction transaction(config);
+    std::vector<std::thread> threads;
+    unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned w = 0; w < workers; w++) {
+      threads.emplace_back([&, w]() {
+        for (size_t i = w; i < files.size(); i += workers) transaction.stage(files[i]);
+      });
+    }
+    for (auto& t : threads) t.join();
+    transaction.commit();
+  }
+  loud();
+  report("transaction, batched syncfs", count, start);
+
+  size_t mb = argc > 3 ? std::stoul(argv[3]) : 512;
+  config.pattern = "node-old";
+  config.replacement = "node-NEW";
+  std::cout << "One file of " << mb << " MB, same-length swap" << std::endl;
+  for (bool in_place : {false, true}) {
+    std::string path = make_large_file(dir, mb);
+    sync();
+    quiet();
+    start = std::chrono::steady_clock::now();
+    if (in_place) {
+      replace_in_place(path, config);
+    } else {
+      ReplaceTransaction transaction(config);
+      transaction.stage(path);
+      transaction.commit();
+    }
+    loud();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "(" << (in_place ? "in place, pwrite" : "transaction, full copy") << ") "
+              << mb / elapsed.count() << " MB/s" << std::endl;
+  }
+
+  fs::remove_all(dir);
+  return 0;
+}
@@ -0,0 +1,90 @@
+// Applying many renames to one text: a find-and-replace pass per rule, the
+// way running -r once per rule does, against the single leftmost-longest
+// pass over the RuleSet automaton used by `--rules`. Both run in memory, so
+// this measures the matching and not the disk.
+//
+// Build from the repository root:
+//   g++ -O2 -std=c++20 tests/rules_bench.cpp assignment1_d/rules.cpp -o rules_bench
+//   ./rules_bench [size_mb] [rules]
+#include "../assignment1_d/rules.h"
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <random>
+
+std::string make_identifier(std::mt19937& gen)
+{
+  static const char* parts[] = {"user", "account", "order", "item", "price", "total", "count", "name",
+                                "id", "date", "status", "type", "value", "list", "map", "index"};
+  std::uniform_int_distribution<int> pick(0, 15), length(2, 3);
+  std::string id = parts[pick(gen)];
+  for (int n = length(gen); n > 1; n--) id += std::string("_") + parts[pick(gen)];
+  return id;
+}
+
+std::string one_pass_per_rule(std::string text, const std::vector<Rule>& rules)
+{
+  for (const auto& r : rules) {
+    std::string out;
+    out.reserve(text.size());
+    size_t last = 0, pos;
+    while ((pos = text.find(r.pattern, last)) != std::string::npos) {
+      out.append(text, last, pos - last);
+      out += r.replacement;
+      last = pos + r.pattern.size();
+    }
+    out.append(text, last);
+    text.swap(out);
+  }
+  return text;
+}
+
+std::string single_pass(const std::string& text, const RuleSet& set, std::vector<size_t>& hits)
+{
+  std::string out;
+  out.reserve(text.size());
+  set.rewrite(text.data(), text.size(), true, out, hits);
+  return out;
+}
+
+int main(int argc, char* argv[])
+{
+  size_t mb = argc > 1 ? std::stoul(argv[1]) : 64;
+  size_t rule_count = argc > 2 ? std::stoul(argv[2]) : 200;
+
+  std::mt19937 gen(7);
+  std::vector<Rule> rules;
+  for (size_t i = 0; i < rule_count; i++) {
+    std::string from = make_identifier(gen) + "_" + std::to_string(i);
+    rules.push_back(Rule{from, "renamed_" + std::to_string(i)});
+  }
+
+  // Source-like text where one identifier in twenty is due for a rename.
+  std::string text;
+  std::uniform_int_distribution<size_t> pick_rule(0, rule_count - 1);
+  std::uniform_int_distribution<int> one_in(0, 19);
+  while (text.size() < mb << 20) {
+    text += one_in(gen) == 0 ? rules[pick_rule(gen)].pattern : make_identifier(gen);
+    text += one_in(gen) < 4 ? " = " : (one_in(gen) < 2 ? ";\n" : " ");
+  }
+  std::cout << mb << " MB, " << rule_count << " rules" << std::endl;
+
+  auto start = std::chrono::steady_clock::now();
+  std::string expected = one_pass_per_rule(text, rules);
+  std::chrono::duration<double> per_rule = std::chrono::steady_clock::now() - start;
+
+  RuleSet set(rules);
+  std::vector<size_t> hits(set.size());
+  start = std::chrono::steady_clock::now();
+  std::string got = single_pass(text, set, hits);
+  std::chrono::duration<double> single = std::chrono::steady_clock::now() - start;
+
+  size_t total = 0;
+  for (size_t h : hits) total += h;
+  std::cout << "(one pass per rule) " << mb / per_rule.count() << " MB/s" << std::endl;
+  std::cout << "(one pass, automaton) " << mb / single.count() << " MB/s, " << per_rule.count() / single.count()
+            << "x, " << total << " replacements, " << (got == expected ? "same output" : "OUTPUT DIFFERS") << std::endl;
+  return 0;
+}
@@ -0,0 +1,116 @@
+// Makespan of a mixed corpus (many small files, a few large ones, given
+// small first as in `dataset/small/* dataset/large/*`): files handed out in
+// command line order against the WorkPlan order, longest first with large
+// files cut into pieces.
+//
+// Every job is timed on its own (warm cache), then the pool's greedy
+// hand-out (next job to the first idle worker) is replayed for 1 to 16
+// workers, so the result does not depend on how many cores this machine
+// happens to have.
+//
+// Build from the repository root:
+//   g++ -O2 -std=c++20 -pthread tests/schedule_bench.cpp assignment1_d/scheduler.cpp assignment1_d/file_processor.cpp assignment1_d/json_writer.cpp assignment1_d/input_source.cpp assignment1_d/logger.cpp assignment1_d/utf8_fold.cpp assignment1_d/placement.cpp -lz -o schedule_bench
+//   ./schedule_bench [small_dir large_dir]   (default: generated in /tmp)
+#include "../assignment1_d/scheduler.h"
+#include "../assignment1_d/file_processor.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+void generate(const std::string& dir, size_t files, size_t bytes)
+{
+  fs::create_directories(dir);
+  std::mt19937 gen(files);
+  const char* words[] = {"hello", "world", "grep", "thread", "mutex", "queue", "worker", "search"};
+  std::uniform_int_distribution<int> pick(0, 7);
+  std::string text;
+  while (text.size() < bytes) {
+    text += words[pick(gen)];
+    text += text.size() % 80 < 8 ? '\n' : ' ';
+  }
+  for (size_t i = 0; i < files; i++) std::ofstream(dir + "/" + std::to_string(i) + ".txt") << text;
+}
+
+std::vector<std::string> list(const std::string& dir)
+{
+  std::vector<std::string> files;
+  for (const auto& entry : fs::directory_iterator(dir)) files.push_back(entry.path().string());
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+double seconds(const std::function<void()>& job)
+{
+  auto start = std::chrono::steady_clock::now();
+  job();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Each job goes to whichever worker is free first, like AdaptivePool.
+double makespan(const std::vector<double>& jobs, size_t workers)
+{
+  std::vector<double> free_at(workers, 0);
+  for (double t : jobs) {
+    auto first = std::min_element(free_at.begin(), free_at.end());
+    *first += t;
+  }
+  return *std::max_element(free_at.begin(), free_at.end());
+}
+
+int main(int argc, char* argv[])
+{
+  std::string small_dir = argc > 2 ? argv[1] : "/tmp/schedule_bench/small";
+  std::string large_dir = argc > 2 ? argv[2] : "/tmp/schedule_bench/large";
+  if (argc <= 2) {
+    generate(small_dir, 400, 64 << 10);
+    generate(large_dir, 2, 256 << 20);
+  }
+
+  Config config;
+  config.pattern = "hello";
+  config.count_only = true;
+  config.files = list(small_dir);
+  for (const auto& f : list(large_dir)) config.files.push_back(f);
+
+  // Warm the page cache.
+  for (const auto& f : config.files) {
+    Shared data;
+    execute_search(f, config, data);
+  }
+
+  std::vector<double> in_order;
+  for (const auto& f : config.files) {
+    Shared data;
+    in_order.push_back(seconds([&]() { execute_search(f, config, data); }));
+  }
+
+  WorkPlan plan(config);
+  std::vector<double> planned;
+  Shared data;
+  for (const auto& item : plan.items()) {
+    planned.push_back(seconds([&]() {
+      if (item.piece) plan.search_piece(item, config, data);
+      else execute_search(config.files[item.file], config, data);
+    }));
+  }
+
+  std::cout << config.files.size() << " files, " << plan.items().size() << " jobs after splitting "
+            << plan.split_files() << " of them" << std::endl;
+  for (size_t workers : {1, 2, 4, 8, 16}) {
+    double before = makespan(in_order, workers);
+    double after = makespan(planned, workers);
+    std::cout << "(" << workers << " workers) command line order " << before * 1000 << " ms, longest first "
+              << after * 1000 << " ms, " << before / after << "x" << std::endl;
+  }
+
+  if (argc <= 2) fs::remove_all("/tmp/schedule_bench");
+  return 0;
+}
@@ -0,0 +1,133 @@
+// Count-only search throughput: the per-flag specialised kernels behind
+// execute_search against a loop that checks the flags at run time, the way
+// execute_search did before it was split into kernels.
+//
+// Build from the repository root:
+//   g++ -O2 -std=c++20 -pthread tests/search_kernel_bench.cpp assignment1_d/file_processor.cpp assignment1_d/json_writer.cpp assignment1_d/input_source.cpp assignment1_d/logger.cpp assignment1_d/utf8_fold.cpp assignment1_d/placement.cpp -lz -o search_kernel_bench
+//   ./search_kernel_bench [size_mb]
+#include "../assignment1_d/file_processor.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+const char* CORPUS_PATH = "/tmp/search_kernel_bench.txt";
+
+void write_corpus(size_t target_bytes)
+{
+  std::ifstream file("dataset/10000_most_common");
+  std::vector<std::string> words;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty()) words.push_back(line);
+  }
+  if (words.empty()) {
+    words = {"hello", "world", "concurrency", "thread", "mutex"};
+  }
+
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<size_t> pick(0, words.size() - 1);
+  std::ofstream out(CORPUS_PATH);
+  std::string text;
+  size_t written = 0, count = 0;
+  while (written < target_bytes) {
+    text.clear();
+    for (int i = 0; i < 50; i++) {
+      std::string w = words[pick(gen)];
+      // Some capitals, so that -i has something to fold.
+      if (++count % 7 == 0) w[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(w[0])));
+      text += w;
+      text += i == 49 ? '\n' : ' ';
+    }
+    out << text;
+    written += text.size();
+  }
+}
+
+// The old shape: one loop for every flag combination, deciding at run time.
+size_t runtime_flags(const Config& config)
+{
+  int fd = open(CORPUS_PATH, O_RDONLY);
+  std::string pattern = config.pattern;
+  if (config.ignore_case) {
+    std::transform(pattern.begin(), pattern.end(), pattern.begin(), [](unsigned char c) { return std::tolower(c); });
+  }
+  std::vector<char> buffer(2 << 20);
+  size_t carry = 0, count = 0;
+  const size_t keep = pattern.size() - 1;
+  while (true) {
+    ssize_t got = read(fd, buffer.data() + carry, buffer.size() - carry);
+    if (got <= 0) break;
+    size_t filled = carry + got;
+    if (config.ignore_case) {
+      std::transform(buffer.data() + carry, buffer.data() + filled, buffer.data() + carry,
+                     [](unsigned char c) { return std::tolower(c); });
+    }
+    std::string_view view(buffer.data(), filled);
+    size_t last_pos = 0, find_pos;
+    while ((find_pos = view.find(pattern, last_pos)) != std::string_view::npos) {
+      count++;
+      last_pos = find_pos + pattern.size();
+      if (config.files_with_matches || config.print_lines) break;
+    }
+    size_t resume = std::max(filled > keep ? filled - keep : 0, std::min(last_pos, filled));
+    carry = filled - resume;
+    std::memmove(buffer.data(), buffer.data() + resume, carry);
+  }
+  close(fd);
+  return count;
+}
+
+size_t kernel(const Config& config)
+{
+  Shared data;
+  auto result = execute_search(CORPUS_PATH, config, data);
+  return result ? result->count : 0;
+}
+
+double best_seconds(const std::function<size_t()>& run, size_t& count)
+{
+  double best = 1e30;
+  for (int i = 0; i < 5; i++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    count = run();
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+int main(int argc, char* argv[])
+{
+  size_t mb = argc > 1 ? std::stoul(argv[1]) : 256;
+  write_corpus(mb * 1024 * 1024);
+  std::cout << "Corpus: " << mb << " MB, best of 5 runs" << std::endl;
+
+  for (bool ignore_case : {false, true}) {
+    Config config;
+    config.pattern = "hello";
+    config.count_only = true;
+    config.ignore_case = ignore_case;
+    config.files = {CORPUS_PATH};
+
+    size_t expected, got;
+    double base = best_seconds([&]() { return runtime_flags(config); }, expected);
+    double fast = best_seconds([&]() { return kernel(config); }, got);
+    std::string name = ignore_case ? "count -i" : "count";
+    std::cout << "(" << name << ", run-time flags) " << mb / base << " MB/s" << std::endl;
+    std::cout << "(" << name << ", specialised kernel) " << mb / fast << " MB/s, " << base / fast << "x, "
+              << (got == expected ? "same count" : "COUNT DIFFERS") << std::endl;
+  }
+
+  unlink(CORPUS_PATH);
+  return 0;
+}
@@ -0,0 +1,124 @@
+// Small repeated searches: a new grep process per search against requests to a
+// warm `grep --serve` process. Reports requests/sec and latency percentiles.
+//
+// Build the tool first (see assignment1_d), then from the repository root:
+//   g++ -O2 -std=c++20 -pthread tests/serve_bench.cpp -o serve_bench
+//   ./serve_bench ./grep 500 hello dataset/small/*.txt
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+using Clock = std::chrono::steady_clock;
+
+const char* SOCKET_PATH = "/tmp/serve_bench.sock";
+
+pid_t spawn(const std::vector<std::string>& args)
+{
+  pid_t pid = fork();
+  if (pid == 0) {
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    std::vector<char*> argv;
+    for (const auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+  return pid;
+}
+
+// One request over the socket, returns the number of bytes in the answer.
+size_t request(const std::string& line)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, SOCKET_PATH);
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    close(fd);
+    return 0;
+  }
+  write(fd, line.data(), line.size());
+  char buffer[4096];
+  size_t total = 0;
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) total += n;
+  close(fd);
+  return total;
+}
+
+void report(const std::string& name, std::vector<double> latencies_us, double seconds)
+{
+  std::sort(latencies_us.begin(), latencies_us.end());
+  auto pct = [&](double p) { return latencies_us[std::min(latencies_us.size() - 1, size_t(p * latencies_us.size()))]; };
+  std::cout << "(" << name << ") " << latencies_us.size() / seconds << " req/s, p50 " << pct(0.50)
+            << " us, p99 " << pct(0.99) << " us" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 5) {
+    std::cerr << "usage: " << argv[0] << " <grep binary> <requests> <pattern> <file>..." << std::endl;
+    return 1;
+  }
+  std::string binary = argv[1];
+  size_t requests = std::stoul(argv[2]);
+  std::vector<std::string> search = {"-c", argv[3]};
+  search.insert(search.end(), argv + 4, argv + argc);
+
+  // One process per search, the way monitoring scripts call it today.
+  std::vector<std::string> command = {binary};
+  command.insert(command.end(), search.begin(), search.end());
+  std::vector<double> latencies;
+  auto start = Clock::now();
+  for (size_t i = 0; i < requests; i++) {
+    auto t0 = Clock::now();
+    int status;
+    waitpid(spawn(command), &status, 0);
+    latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+  }
+  report("one process per search", latencies, std::chrono::duration<double>(Clock::now() - start).count());
+
+  pid_t server = spawn({binary, "--serve", SOCKET_PATH});
+  std::string line;
+  for (const auto& a : search) line += (line.empty() ? "" : "\t") + a;
+  line += "\n";
+  while (request(line) == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  for (unsigned clients : {1u, 4u, 16u}) {
+    std::vector<std::vector<double>> per_client(clients);
+    std::vector<std::thread> threads;
+    start = Clock::now();
+    for (unsigned c = 0; c < clients; c++) {
+      threads.emplace_back([&, c]() {
+        for (size_t i = c; i < requests; i += clients) {
+          auto t0 = Clock::now();
+          request(line);
+          per_client[c].push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+        }
+      });
+    }
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    latencies.clear();
+    for (auto& l : per_client) latencies.insert(latencies.end(), l.begin(), l.end());
+    report("--serve, " + std::to_string(clients) + " clients", latencies, seconds);
+  }
+
+  kill(server, SIGTERM);
+  waitpid(server, nullptr, 0);
+  unlink(SOCKET_PATH);
+  return 0;
+}
@@ -0,0 +1,117 @@
+// Word frequency counting: single threaded std::unordered_map against the
+// per-thread WordTable + parallel merge used by `--wordcount`.
+//
+// Build from the repository root:
+//   g++ -O2 -std=c++20 -pthread tests/wordcount_bench.cpp assignment1_d/word_counter.cpp assignment1_d/input_source.cpp assignment1_d/logger.cpp -lz -o wordcount_bench
+//   ./wordcount_bench [size_mb]
+#include "../assignment1_d/word_counter.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
+#include <cctype>
+
+std::string build_corpus(size_t target_bytes)
+{
+  std::ifstream file("dataset/10000_most_common");
+  std::vector<std::string> words;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (!line.empty()) words.push_back(line);
+  }
+  if (words.empty()) {
+    words = {"hello", "world", "concurrency", "thread", "mutex"};
+  }
+
+  // Zipf-ish skew, real text is never uniform.
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<> u(0.0, 1.0);
+  std::string corpus;
+  corpus.reserve(target_bytes + 64);
+  size_t count = 0;
+  while (corpus.size() < target_bytes) {
+    size_t idx = static_cast<size_t>(words.size() * u(gen) * u(gen));
+    corpus += words[idx];
+    corpus += (++count % 50 == 0) ? '\n' : ' ';
+  }
+  return corpus;
+}
+
+std::vector<std::pair<std::string, uint64_t>> baseline(const std::string& text, size_t k)
+{
+  std::unordered_map<std::string, uint64_t> counts;
+  std::string word;
+  for (unsigned char c : text) {
+    if (std::isalnum(c) || c >= 0x80) {
+      word += static_cast<char>(c);
+    } else if (!word.empty()) {
+      counts[word]++;
+      word.clear();
+    }
+  }
+  if (!word.empty()) counts[word]++;
+
+  std::vector<std::pair<std::string, uint64_t>> all(counts.begin(), counts.end());
+  size_t n = std::min(k, all.size());
+  std::partial_sort(all.begin(), all.begin() + n, all.end(), [](const auto& a, const auto& b) {
+    return a.second != b.second ? a.second > b.second : a.first > b.first;
+  });
+  all.resize(n);
+  return all;
+}
+
+std::vector<std::pair<std::string, uint64_t>> parallel(const std::string& text, size_t k, size_t thread_count)
+{
+  std::vector<WordTable> tables(thread_count);
+  std::vector<std::thread> threads;
+
+  size_t begin = 0;
+  for (size_t t = 0; t < thread_count; t++) {
+    size_t end = t + 1 == thread_count ? text.size() : text.size() * (t + 1) / thread_count;
+    // Never cut a word in half.
+    while (end < text.size() && text[end] != ' ' && text[end] != '\n') end++;
+    threads.emplace_back([&, t, begin, end]() {
+      uint64_t words = 0;
+      tables[t].count_words(text.data() + begin, end - begin, false, true, words);
+    });
+    begin = end;
+  }
+  for (auto& th : threads) th.join();
+
+  return merge_top_k(tables, k, thread_count);
+}
+
+int main(int argc, char* argv[])
+{
+  size_t mb = argc > 1 ? std::stoul(argv[1]) : 256;
+  const size_t k = 20;
+
+  std::string text = build_corpus(mb * 1024 * 1024);
+  std::cout << "Corpus: " << mb << " MB" << std::endl;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  auto expected = baseline(text, k);
+  std::chrono::duration<double> base = std::chrono::high_resolution_clock::now() - start;
+  std::cout << "(std::unordered_map, 1 Thread) " << mb / base.count() << " MB/s" << std::endl;
+
+  unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+    start = std::chrono::high_resolution_clock::now();
+    auto top = parallel(text, k, threads);
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    bool same = top.size() == expected.size();
+    for (size_t i = 0; same && i < top.size(); i++) {
+      same = top[i].second == expected[i].second;
+    }
+    std::cout << "(WordTable, " << threads << " Threads) " << mb / elapsed.count() << " MB/s, "
+              << base.count() / elapsed.count() << "x, top-" << k << (same ? " matches" : " DIFFERS") << std::endl;
+  }
+
+  return 0;
+}